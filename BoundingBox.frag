@@ -0,0 +1,8 @@
+#version 330
+
+// só o teste de profundidade importa: cor e profundidade não são escritas
+out vec4 FragColor;
+
+void main(){
+	FragColor = vec4(1);
+}
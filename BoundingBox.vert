@@ -0,0 +1,17 @@
+#version 330
+
+layout(std140, row_major) uniform ObjectBlock{
+	mat4 ModelView;
+	mat4 MVP;
+	mat3 NormalMatrix;
+};
+
+uniform vec3 bbox_min;
+uniform vec3 bbox_max;
+
+// vértices de um cubo [0,1]^3
+layout(location=0) in vec3 Position;
+
+void main(){
+	gl_Position = MVP*vec4(mix(bbox_min, bbox_max, Position), 1);
+}
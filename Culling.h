@@ -0,0 +1,177 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "matrix.h"
+
+#if defined(__AVX__)
+#define CULLING_AVX
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define CULLING_SSE
+#include <xmmintrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////
+// The six planes (a, b, c, d) of the view volume of Projection*View,
+// with normals pointing inwards and normalized, so that a*x + b*y +
+// c*z + d is the signed distance of a world space point.
+struct Frustum{
+	vec4 planes[6];
+
+	Frustum() = default;
+
+	// A point p is inside when -w <= x, y, z <= w for (x, y, z, w) = M*p,
+	// which gives the planes row3 + row_i and row3 - row_i.
+	Frustum(mat4 M){
+		for(int i = 0; i < 3; i++){
+			planes[2*i]   = M[3] + M[i];
+			planes[2*i+1] = M[3] - M[i];
+		}
+		for(vec4& p: planes){
+			float n = norm(toVec3(p));
+			if(n > 0)
+				p = (1/n)*p;
+		}
+	}
+
+	bool sphere_visible(vec3 c, float r) const{
+		for(const vec4& p: planes)
+			if(p.x*c.x + p.y*c.y + p.z*c.z + p.w < -r)
+				return false;
+		return true;
+	}
+};
+
+////////////////////////////////////////////////////////////////////
+// World space bounding spheres of many objects, stored as separate
+// x, y, z and radius arrays so that the frustum test runs on 4 (SSE)
+// or 8 (AVX) spheres at once.
+class SphereCuller{
+	static const int lanes = 8;
+	std::vector<float> cx, cy, cz, radius;
+	unsigned int n = 0;
+
+	public:
+	struct Stats{
+		unsigned int tested = 0;
+		unsigned int visible = 0;
+		unsigned int culled() const{ return tested - visible; }
+	}stats;
+
+	void clear(){
+		n = 0;
+		cx.clear();
+		cy.clear();
+		cz.clear();
+		radius.clear();
+	}
+
+	unsigned int size() const{
+		return n;
+	}
+
+	unsigned int add(vec3 center, float r){
+		// the arrays are padded to a multiple of lanes with spheres
+		// that no plane accepts
+		if(n % lanes == 0){
+			cx.resize(n + lanes, 0);
+			cy.resize(n + lanes, 0);
+			cz.resize(n + lanes, 0);
+			radius.resize(n + lanes, -INFINITY);
+		}
+		set(n, center, r);
+		return n++;
+	}
+
+	void set(unsigned int i, vec3 center, float r){
+		cx[i] = center.x;
+		cy[i] = center.y;
+		cz[i] = center.z;
+		radius[i] = r;
+	}
+
+	// Fills visible with the indices of the spheres that are not
+	// completely outside some plane of frustum.
+	void cull(const Frustum& frustum, std::vector<unsigned int>& visible){
+		visible.clear();
+		visible.reserve(n);
+
+#if defined(CULLING_AVX)
+		for(unsigned int i = 0; i < n; i += 8){
+			__m256 x = _mm256_loadu_ps(&cx[i]);
+			__m256 y = _mm256_loadu_ps(&cy[i]);
+			__m256 z = _mm256_loadu_ps(&cz[i]);
+			__m256 neg_r = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&radius[i]));
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for(const vec4& p: frustum.planes){
+				__m256 d = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(p.x)), _mm256_set1_ps(p.w));
+				d = _mm256_add_ps(d, _mm256_mul_ps(y, _mm256_set1_ps(p.y)));
+				d = _mm256_add_ps(d, _mm256_mul_ps(z, _mm256_set1_ps(p.z)));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, neg_r, _CMP_GE_OQ));
+			}
+			push_mask(_mm256_movemask_ps(inside), i, visible);
+		}
+#elif defined(CULLING_SSE)
+		for(unsigned int i = 0; i < n; i += 4){
+			__m128 x = _mm_loadu_ps(&cx[i]);
+			__m128 y = _mm_loadu_ps(&cy[i]);
+			__m128 z = _mm_loadu_ps(&cz[i]);
+			__m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&radius[i]));
+			__m128 inside = _mm_cmpeq_ps(x, x); // all ones, coordinates are never NaN
+			for(const vec4& p: frustum.planes){
+				__m128 d = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(p.x)), _mm_set1_ps(p.w));
+				d = _mm_add_ps(d, _mm_mul_ps(y, _mm_set1_ps(p.y)));
+				d = _mm_add_ps(d, _mm_mul_ps(z, _mm_set1_ps(p.z)));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(d, neg_r));
+			}
+			push_mask(_mm_movemask_ps(inside), i, visible);
+		}
+#else
+		for(unsigned int i = 0; i < n; i++)
+			if(frustum.sphere_visible({cx[i], cy[i], cz[i]}, radius[i]))
+				visible.push_back(i);
+#endif
+
+		stats.tested = n;
+		stats.visible = visible.size();
+	}
+
+	private:
+	void push_mask(int mask, unsigned int first, std::vector<unsigned int>& visible) const{
+		while(mask){
+			unsigned int i = first + count_trailing_zeros(mask);
+			if(i < n)
+				visible.push_back(i);
+			mask &= mask - 1;
+		}
+	}
+
+	static int count_trailing_zeros(int mask){
+#if defined(__GNUC__)
+		return __builtin_ctz(mask);
+#else
+		int i = 0;
+		while(!(mask & 1)){
+			mask >>= 1;
+			i++;
+		}
+		return i;
+#endif
+	}
+};
+
+////////////////////////////////////////////////////////////////////
+// Bounding sphere of the box [bbox_min, bbox_max] after Model.
+inline void bounding_sphere(mat4 Model, vec3 bbox_min, vec3 bbox_max, vec3& center, float& radius){
+	float scale = 0;
+	for(int j = 0; j < 3; j++)
+		scale = std::max(scale, norm(vec3{Model[0][j], Model[1][j], Model[2][j]}));
+
+	center = toVec3(Model*toVec4(0.5*(bbox_min + bbox_max), 1));
+	radius = scale*0.5*norm(bbox_max - bbox_min);
+}
+
+#endif
@@ -0,0 +1,752 @@
+#ifndef GLMESH_H
+#define GLMESH_H
+
+#include <map>
+#include "GLutils.h"
+#include "ObjMesh.h"
+#include "TextureResidency.h"
+#include "TextureAtlas.h"
+#include "TextureArrays.h"
+#include "ShaderPermutations.h"
+#include "Transforms.h"
+#include "Culling.h"
+#include "SceneBVH.h"
+#include "OcclusionCuller.h"
+#include "OcclusionQueries.h"
+#include "RenderQueue.h"
+#include "GeometryHeap.h"
+#include "Instancing.h"
+
+using Vertex = ObjMesh::Vertex;
+
+inline void init_texture_params(){
+	glGenerateMipmap(GL_TEXTURE_2D);
+
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	if(GLEW_EXT_texture_filter_anisotropic){
+		GLfloat fLargest;
+		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &fLargest);
+		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, fLargest);
+	}
+}
+
+inline GLTexture init_texture(std::string image, TextureUsage usage = TextureUsage::Color){
+	GLTexture texture{GL_TEXTURE_2D};
+	texture.load(image, GL_TEXTURE_2D, usage);
+	init_texture_params();
+	return texture;
+}
+
+inline GLTexture init_texture(const Image& image, TextureUsage usage = TextureUsage::Color){
+	GLTexture texture{GL_TEXTURE_2D};
+	texture.load(image, GL_TEXTURE_2D, usage);
+	init_texture_params();
+	return texture;
+}
+
+inline MaterialInfo standard_material(std::string mat_Kd){
+	MaterialInfo mat;
+
+	mat.name = "standard";
+
+	mat.Ka = {1, 1, 1};
+	mat.Kd = {1, 1, 1};
+	mat.Ks = {0, 0, 0};
+	mat.Ns = 1;
+
+	mat.map_Kd = mat_Kd;
+
+	return mat;
+}
+
+struct GLMeshOptions{
+	TextureResidency* residency = nullptr;
+
+	// Pack diffuse maps up to atlas_max_texture pixels into atlases
+	// and merge the material ranges that then become identical. Not
+	// done with arrays, whose layers come from files.
+	bool atlas = false;
+	int atlas_max_texture = 512;
+
+	// Put the textures in shared texture arrays (see TextureArrays.h);
+	// draw with PhongTexLightsArray.frag.
+	TextureArrays* arrays = nullptr;
+
+	// Draw each material with the shader variant of its maps and alpha
+	// test instead of the program in use.
+	ShaderPermutations* permutations = nullptr;
+
+	// Keep the triangles (or those of the simplified occluder_lod obj)
+	// on the CPU to rasterize them in an OcclusionCuller.
+	bool occluder = false;
+	std::string occluder_lod = "";
+
+	// Draw behind an occlusion query of the bounding box (see 
+	// OcclusionQueries.h) when the mesh has at least query_min_triangles.
+	OcclusionQueries* queries = nullptr;
+	unsigned int query_min_triangles = 5000;
+
+	// Put the vertices and indices in the shared buffers of heap instead
+	// of buffers of the mesh (see GeometryHeap.h).
+	GeometryHeap* heap = nullptr;
+};
+
+struct SurfaceMesh{
+	std::vector<Vertex> vertices;
+	std::vector<unsigned int> indices;
+};
+
+// std140 layout of the MaterialBlock uniform block.
+struct MaterialStd140{
+	vec3 Ka; float pad0;
+	vec3 Kd; float pad1;
+	vec3 Ks; float shininess;
+};
+
+// A material range with everything draw() needs already resolved.
+struct DrawPacket{
+	unsigned int first;
+	unsigned int count;
+	unsigned int material;        // index of the material range
+	unsigned int material_offset; // into the material uniform buffer
+	int has_map;                  // bit 0: map_Ka, 1: map_Kd, 2: map_Ks
+	unsigned int key;             // ShaderPermutations key: has_map and ALPHA_TEST
+	unsigned int textures[3];     // Ka, Kd, Ks (texture arrays with GLMeshOptions::arrays)
+	int layers[3];                // layers in the texture arrays, -1 if none
+};
+
+class GLMesh{
+	VAO vao;
+	GLBuffer vbo;
+	GLBuffer ebo;
+	GeometryHeap* heap = nullptr;
+	GeometryBlock geometry; // instead of vao, vbo and ebo with a heap
+	std::vector<MaterialRange> materials;
+	mutable std::map<std::string, std::shared_ptr<GLTexture>> texture_map;
+	// programs this mesh already loaded the textures for
+	mutable std::vector<unsigned int> prepared_programs;
+	std::string path;
+	TextureResidency* residency = nullptr;
+	TextureArrays* arrays = nullptr;
+	ShaderPermutations* permutations = nullptr;
+	std::vector<float> uv_density;
+	std::vector<bool> alpha_tested;
+	// atlases made by build_atlas: whether a texture in them has alpha
+	std::map<std::string, bool> atlas_alpha;
+	GLBuffer material_ubo;
+	unsigned int material_stride = 0;
+	// rebuilt when textures are loaded or become resident
+	mutable std::vector<DrawPacket> packets;
+	mutable bool packets_dirty = true;
+	mutable unsigned int packets_version = 0; // RenderItems refer to one
+	mutable unsigned long residency_generation = 0;
+	std::vector<vec3> occluder_tris;
+	OcclusionQueries* queries = nullptr;
+	GLQuery query;
+	mutable bool query_pending = false;
+	// draw(RenderQueue) tests the query once per call
+	mutable unsigned int query_queue_pass = 0;
+	mutable bool query_issued = false;
+	public:
+	mat4 Model;
+	vec3 bbox_min, bbox_max;
+	// matrices read by ObjectBlock, see Transforms.h
+	TransformSlot transform;
+
+	GLMesh() = default;
+
+	GLMesh(std::string obj_file, mat4 _Model, MaterialInfo std_mat=standard_material(""), 
+			GLMeshOptions options = {}){
+		residency = options.residency;
+		arrays = options.arrays;
+		permutations = options.permutations;
+		heap = options.heap;
+		ObjMesh mesh{obj_file};
+		path = mesh.path;
+		std::vector<Vertex> tris = mesh.getTriangles();
+		materials = mesh.getMaterials(std_mat);
+
+		if(options.atlas && !options.arrays)
+			build_atlas(tris, options.atlas_max_texture);
+
+		init_buffers(tris);
+
+		if(options.occluder_lod != "")
+			init_occluder(ObjMesh{options.occluder_lod}.getTriangles());
+		else if(options.occluder)
+			init_occluder(tris);
+
+		for(MaterialRange range: materials)
+			uv_density.push_back(compute_uv_density(range.first, range.count, 
+				[&](unsigned int i){ return tris[i]; }));
+
+		init_materials();
+		init_query(options);
+		Model = _Model;
+	}
+	
+	GLMesh(const SurfaceMesh& surface, mat4 _Model, MaterialInfo std_mat = standard_material(""), 
+			GLMeshOptions options = {}){
+		residency = options.residency;
+		arrays = options.arrays;
+		permutations = options.permutations;
+		heap = options.heap;
+		Model = _Model;
+		init_buffers(surface.vertices, surface.indices);
+
+		unsigned int size = surface.indices.size();
+
+		if(options.occluder)
+			for(unsigned int i: surface.indices)
+				occluder_tris.push_back(surface.vertices[i].position);
+
+		materials = {
+			{std_mat, 0, size}
+		};
+		uv_density = {compute_uv_density(0, size, 
+			[&](unsigned int i){ return surface.vertices[surface.indices[i]]; })};
+		init_materials();
+		init_query(options);
+	}
+
+	void init_occluder(const std::vector<Vertex>& tris){
+		for(const Vertex& v: tris)
+			occluder_tris.push_back(v.position);
+	}
+
+	void init_query(const GLMeshOptions& options){
+		unsigned int triangles = 0;
+		for(const MaterialRange& range: materials)
+			triangles += range.count/3;
+		if(options.queries && triangles >= options.query_min_triangles){
+			queries = options.queries;
+			query = GLQuery{true};
+		}
+	}
+
+	bool is_occluder() const{
+		return !occluder_tris.empty();
+	}
+
+	// Object space triangles for OcclusionCuller::add_occluder.
+	const std::vector<vec3>& occluder_triangles() const{
+		return occluder_tris;
+	}
+
+	// Material ranges, textures resolved, in the order draw() uses them.
+	const std::vector<DrawPacket>& draw_packets() const{
+		prepare();
+		return packets;
+	}
+
+	const MaterialInfo& material(unsigned int i) const{
+		return materials[i].mat;
+	}
+
+	unsigned int material_count() const{
+		return materials.size();
+	}
+
+	// Copies the vertices back from the GPU. indices are generated for
+	// meshes drawn with glDrawArrays, so that both kinds index vertices.
+	void read_geometry(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) const{
+		auto read = [](unsigned int buffer, auto& V){
+			GLint size = 0;
+			glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+			glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
+			V.resize(size/sizeof(V[0]));
+			glGetBufferSubData(GL_COPY_READ_BUFFER, 0, V.size()*sizeof(V[0]), V.data());
+		};
+		if(geometry)
+			heap->read(geometry, vertices, indices);
+		else
+			read(vbo, vertices);
+
+		if(ebo != 0){
+			read(ebo, indices);
+		}else if(!indexed()){
+			indices.resize(vertices.size());
+			for(unsigned int i = 0; i < indices.size(); i++)
+				indices[i] = i;
+		}
+	}
+
+	// One MaterialStd140 per range, each at an offset glBindBufferRange accepts.
+	void init_materials(){
+		int alignment;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		material_stride = align_up(sizeof(MaterialStd140), alignment);
+
+		std::vector<unsigned char> data(materials.size()*material_stride);
+		for(unsigned int i = 0; i < materials.size(); i++){
+			const MaterialInfo& mat = materials[i].mat;
+			MaterialStd140 m = {mat.Ka, 0, mat.Kd, 0, mat.Ks, mat.Ns};
+			memcpy(data.data() + i*material_stride, &m, sizeof m);
+		}
+
+		material_ubo = GLBuffer{GL_UNIFORM_BUFFER};
+		material_ubo.data(data, GL_STATIC_DRAW);
+
+		// diffuse maps with alpha need the alpha test
+		alpha_tested.clear();
+		for(const MaterialRange& range: materials)
+			alpha_tested.push_back(has_alpha(range.mat.map_Kd));
+	}
+
+	bool has_alpha(const std::string& map) const{
+		auto it = atlas_alpha.find(map);
+		if(it != atlas_alpha.end())
+			return it->second;
+		int w, h, n = 0;
+		return map != "" && image_info(path + map, w, h, n) && (n == 2 || n == 4);
+	}
+
+	void init_buffers(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices = {}){
+		bbox_min = bbox_max = vertices.empty()? vec3{0, 0, 0}: vertices[0].position;
+		for(const Vertex& v: vertices){
+			bbox_min = {std::min(bbox_min.x, v.position.x), std::min(bbox_min.y, v.position.y), std::min(bbox_min.z, v.position.z)};
+			bbox_max = {std::max(bbox_max.x, v.position.x), std::max(bbox_max.y, v.position.y), std::max(bbox_max.z, v.position.z)};
+		}
+
+		if(heap){
+			geometry = heap->allocate(vertices, indices);
+			if(geometry)
+				return;
+			// no room in the heap: buffers of its own
+		}
+
+		vao = VAO{true};
+		bind_vertex_array(vao);
+
+		vbo = GLBuffer{GL_ARRAY_BUFFER};
+		vbo.data(vertices, GL_STATIC_DRAW);
+
+		vertex_layout(vbo);
+
+		if(!indices.empty()){
+			ebo = GLBuffer{GL_ELEMENT_ARRAY_BUFFER};
+			ebo.data(indices, GL_STATIC_DRAW);
+		}
+	}
+
+	unsigned int vertex_array() const{
+		return geometry? geometry.vao(): (unsigned int)vao;
+	}
+
+	bool indexed() const{
+		return geometry? geometry.indexed(): ebo != 0;
+	}
+
+	unsigned int vertex_buffer() const{
+		return geometry? heap->vertex_buffer(geometry): (unsigned int)vbo;
+	}
+
+	unsigned int index_buffer() const{
+		if(geometry)
+			return geometry.indexed()? heap->index_buffer(geometry): 0;
+		return ebo;
+	}
+	
+	void load_texture(std::string path, std::string file, TextureUsage usage = TextureUsage::Color) const{
+		if(file == "" || texture_map.find(file) != texture_map.end())
+			return;
+
+		if(residency){
+			residency->add(path + file, usage);
+			return;
+		}
+
+		if(arrays){
+			arrays->add(path + file);
+			return;
+		}
+
+		packets_dirty = true;
+		std::string img = path + file;
+		std::cout << "read image " << img << '\n';
+		texture_map[file] = texture_cache.get(img, usage, [](const Image& image, TextureUsage usage){
+			return init_texture(image, usage);
+		});
+		if(!texture_map[file])
+			std::cout << "ERROR: could not read texture " << img << '\n';
+	}
+
+	// Moves the diffuse maps of the ranges that only use map_Kd (or the 
+	// same file as map_Ka) and whose texture coordinates stay in [0,1]
+	// into atlases, rewriting the texture coordinates of tris.
+	void build_atlas(std::vector<Vertex>& tris, int max_texture){
+		auto in_unit_square = [&](const MaterialRange& range){
+			const float eps = 1e-4;
+			for(unsigned int i = range.first; i < range.first + range.count; i++){
+				vec2 uv = tris[i].texCoords;
+				if(uv.x < -eps || uv.x > 1+eps || uv.y < -eps || uv.y > 1+eps)
+					return false;
+			}
+			return true;
+		};
+
+		std::vector<bool> candidate(materials.size());
+		std::map<std::string, Image> images;
+		for(unsigned int i = 0; i < materials.size(); i++){
+			const MaterialInfo& mat = materials[i].mat;
+			if(mat.map_Kd == "" || mat.map_Ks != "" || (mat.map_Ka != "" && mat.map_Ka != mat.map_Kd))
+				continue;
+			if(!in_unit_square(materials[i]))
+				continue;
+
+			int w, h, n;
+			if(!image_info(path + mat.map_Kd, w, h, n) || std::max(w, h) > max_texture)
+				continue;
+
+			candidate[i] = true;
+			if(images.find(mat.map_Kd) == images.end())
+				images[mat.map_Kd] = load_image(path + mat.map_Kd, true);
+		}
+
+		if(images.size() < 2)
+			return;
+
+		// no larger than the quality tier keeps, so that the gutters are
+		// not downscaled
+		int max_size = texture_policy.max_size();
+		std::vector<TextureAtlas> atlases = build_atlases(images, max_size > 0? std::min(max_size, 2048): 2048);
+		for(unsigned int a = 0; a < atlases.size(); a++){
+			std::string name = "#atlas" + std::to_string(a);
+			std::cout << "atlas " << name << ": " << atlases[a].rects.size() << " textures, " 
+				<< atlases[a].image.width << 'x' << atlases[a].image.height << '\n';
+			texture_map[name] = std::make_shared<GLTexture>(init_texture(atlases[a].image));
+
+			// coarser mip levels would blend neighbouring textures (fewer
+			// if the memory budget still downscaled the atlas)
+			int width, max_level = atlases[a].max_level();
+			glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+			for(int w = width; w < atlases[a].image.width && max_level > 0; w *= 2)
+				max_level--;
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, max_level);
+			atlas_alpha[name] = atlases[a].alpha;
+
+			for(unsigned int i = 0; i < materials.size(); i++){
+				MaterialInfo& mat = materials[i].mat;
+				if(!candidate[i] || atlases[a].rects.find(mat.map_Kd) == atlases[a].rects.end())
+					continue;
+
+				const MaterialRange& range = materials[i];
+				for(unsigned int k = range.first; k < range.first + range.count; k++)
+					tris[k].texCoords = atlases[a].transform(mat.map_Kd, tris[k].texCoords);
+
+				if(mat.map_Ka == mat.map_Kd)
+					mat.map_Ka = name;
+				mat.map_Kd = name;
+			}
+		}
+
+		merge_ranges();
+	}
+
+	static bool same_material(const MaterialInfo& a, const MaterialInfo& b){
+		auto eq = [](vec3 u, vec3 v){ return u.x == v.x && u.y == v.y && u.z == v.z; };
+		return eq(a.Ka, b.Ka) && eq(a.Kd, b.Kd) && eq(a.Ks, b.Ks) && a.Ns == b.Ns &&
+			a.map_Ka == b.map_Ka && a.map_Kd == b.map_Kd && a.map_Ks == b.map_Ks;
+	}
+
+	// Joins consecutive ranges that draw with the same material.
+	void merge_ranges(){
+		std::vector<MaterialRange> merged;
+		for(const MaterialRange& range: materials){
+			if(!merged.empty()){
+				MaterialRange& last = merged.back();
+				if(last.first + last.count == range.first && same_material(last.mat, range.mat)){
+					last.count += range.count;
+					continue;
+				}
+			}
+			merged.push_back(range);
+		}
+		if(merged.size() < materials.size())
+			std::cout << "merged " << materials.size() << " material ranges into " << merged.size() << '\n';
+		materials = merged;
+	}
+
+	// Textures are loaded on the first draw with each program, and only
+	// the maps whose sampler is active in that program.
+	void prepare_textures(unsigned int program) const{
+		if(std::find(prepared_programs.begin(), prepared_programs.end(), program) != prepared_programs.end())
+			return;
+		prepared_programs.push_back(program);
+
+		const ProgramReflection& reflection = program_reflection(program);
+		bool use_Ka = reflection.samples("map_Ka");
+		bool use_Kd = reflection.samples("map_Kd");
+		bool use_Ks = reflection.samples("map_Ks");
+		bool use_Bump = reflection.samples("map_Bump");
+
+		for(const MaterialRange& range: materials){
+			if(use_Ka)
+				load_texture(path, range.mat.map_Ka);
+			if(use_Kd)
+				load_texture(path, range.mat.map_Kd);
+			if(use_Ks)
+				load_texture(path, range.mat.map_Ks, TextureUsage::Data);
+			if(use_Bump)
+				load_texture(path, range.mat.map_Bump, TextureUsage::Data);
+		}
+
+		if(arrays)
+			arrays->build();
+		packets_dirty = true;
+	}
+
+	unsigned int texture(const std::string& file) const{
+		if(file == "")
+			return 0;
+		auto it = texture_map.find(file);
+		if(it != texture_map.end())
+			return it->second? it->second->id: 0;
+		return residency? residency->get(path + file): 0;
+	}
+
+	// uv units per object space unit, from the triangle areas
+	template<class F>
+	static float compute_uv_density(unsigned int first, unsigned int count, F vertex){
+		float area = 0, uv_area = 0;
+		for(unsigned int i = first; i+2 < first+count; i += 3){
+			Vertex A = vertex(i), B = vertex(i+1), C = vertex(i+2);
+			area += norm(cross(B.position - A.position, C.position - A.position));
+			vec2 u = B.texCoords - A.texCoords;
+			vec2 v = C.texCoords - A.texCoords;
+			uv_area += fabs(u.x*v.y - u.y*v.x);
+		}
+		return area > 0? sqrt(uv_area/area): 0;
+	}
+
+	// World space bounding sphere of the mesh.
+	void bounding_sphere(vec3& center, float& radius) const{
+		::bounding_sphere(Model, bbox_min, bbox_max, center, radius);
+	}
+
+	// World space box around the mesh.
+	AABB world_bounds() const{
+		return transform_box(Model, bbox_min, bbox_max);
+	}
+
+	// Tells the residency manager how much texture resolution this mesh
+	// needs, from the projected size of its bounds.
+	void request_texture_levels(mat4 View, mat4 Projection, int viewport_height) const{
+		if(residency == nullptr)
+			return;
+
+		mat4 MV = View*Model;
+		float scale = 0;
+		for(int j = 0; j < 3; j++)
+			scale = std::max(scale, norm(vec3{MV[0][j], MV[1][j], MV[2][j]}));
+
+		vec3 center = 0.5*(bbox_min + bbox_max);
+		float radius = scale*0.5*norm(bbox_max - bbox_min);
+		float dist = norm(toVec3(MV*toVec4(center, 1))) - radius;
+		dist = std::max(dist, 1e-3f);
+
+		// pixels covered by one object space unit at the nearest point
+		float pixels_per_unit = fabs(Projection[1][1])*viewport_height/2*scale/dist;
+
+		for(unsigned int i = 0; i < materials.size(); i++){
+			const MaterialInfo& mat = materials[i].mat;
+			float texels = uv_density[i] > 0? pixels_per_unit/uv_density[i]: 0;
+			for(const std::string* map: {&mat.map_Ka, &mat.map_Kd, &mat.map_Ks})
+				if(*map != "")
+					residency->request(path + *map, texels);
+		}
+	}
+
+	void compile_packets() const{
+		packets_version++;
+		packets.clear();
+		for(unsigned int i = 0; i < materials.size(); i++){
+			const MaterialRange& range = materials[i];
+			DrawPacket p = {range.first, range.count, i, i*material_stride, 0, 0, {0, 0, 0}, {-1, -1, -1}};
+
+			const std::string* maps[] = {&range.mat.map_Ka, &range.mat.map_Kd, &range.mat.map_Ks};
+			for(int unit = 0; unit < 3; unit++){
+				if(arrays){
+					TextureArrays::Layer layer;
+					if(*maps[unit] != "")
+						layer = arrays->find(path + *maps[unit]);
+					p.textures[unit] = arrays->texture(layer.array);
+					p.layers[unit] = layer.layer;
+				}else{
+					p.textures[unit] = texture(*maps[unit]);
+				}
+				if(p.textures[unit] != 0)
+					p.has_map |= 1 << unit;
+			}
+			p.key = p.has_map | (alpha_tested[i]? ShaderPermutations::ALPHA_TEST: 0);
+			packets.push_back(p);
+		}
+
+		// fewer program changes
+		if(permutations)
+			std::stable_sort(packets.begin(), packets.end(), [](const DrawPacket& a, const DrawPacket& b){
+				return a.key < b.key;
+			});
+		packets_dirty = false;
+		residency_generation = residency? residency->generation: 0;
+	}
+
+	// Program, and its uniforms, of the last packet drawn.
+	struct DrawState{
+		static const unsigned int current_program = ~1u;
+		unsigned int key = ~0u; // ShaderPermutations key, or current_program
+
+		Uniform has_map;
+		Uniform layers[3];
+
+		void program_changed(){
+			Uniform{"map_Ka"} = 0;
+			Uniform{"map_Kd"} = 1;
+			Uniform{"map_Ks"} = 2;
+			has_map = Uniform{"has_map"};
+			layers[0] = Uniform{"layer_Ka"};
+			layers[1] = Uniform{"layer_Kd"};
+			layers[2] = Uniform{"layer_Ks"};
+		}
+	};
+
+	void prepare() const{
+		prepare_textures(permutations? permutations->reference().id: currentProgram());
+		if(packets_dirty || (residency && residency->generation != residency_generation))
+			compile_packets();
+	}
+
+	// Draws one material range (instances times, if not 0) with the
+	// variants of shaders, or the program in use if it is nullptr. The
+	// VAO and transform must be bound.
+	void draw_packet(const DrawPacket& p, DrawState& state, ShaderPermutations* shaders,
+			unsigned int instances = 0) const{
+		static const unsigned int material_binding = uniform_block_binding("MaterialBlock");
+		GLenum target = arrays? GL_TEXTURE_2D_ARRAY: GL_TEXTURE_2D;
+
+		unsigned int key = shaders? p.key: DrawState::current_program;
+		if(key != state.key){
+			state.key = key;
+			if(shaders)
+				use_program(shaders->get(key));
+			state.program_changed();
+		}
+
+		bind_buffer_range(GL_UNIFORM_BUFFER, material_binding, material_ubo, 
+			p.material_offset, sizeof(MaterialStd140));
+		state.has_map = p.has_map;
+
+		for(int unit = 0; unit < 3; unit++){
+			if(arrays)
+				state.layers[unit] = p.layers[unit];
+			if(p.textures[unit] != 0)
+				bind_texture_unit(unit, target, p.textures[unit]);
+		}
+
+		// own buffers start at 0
+		int base_vertex = geometry? geometry.base_vertex(): 0;
+		if(!indexed()){
+			if(instances > 0)
+				glDrawArraysInstanced(GL_TRIANGLES, base_vertex + p.first, p.count, instances);
+			else
+				glDrawArrays(GL_TRIANGLES, base_vertex + p.first, p.count);
+			return;
+		}
+
+		unsigned int first_index = geometry? geometry.first_index(): 0;
+		void* offset = (void*)((first_index + p.first)*sizeof(int));
+		if(instances > 0)
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, p.count, GL_UNSIGNED_INT, offset, 
+				instances, base_vertex);
+		else if(geometry)
+			glDrawElementsBaseVertex(GL_TRIANGLES, p.count, GL_UNSIGNED_INT, offset, base_vertex);
+		else
+			glDrawElements(GL_TRIANGLES, p.count, GL_UNSIGNED_INT, offset);
+	}
+
+	void draw() const{
+		prepare();
+		bool conditional = queries && queries->begin(query, query_pending, transform, bbox_min, bbox_max);
+
+		DrawState state;
+		transform.bind();
+		bind_vertex_array(vertex_array());
+		for(const DrawPacket& p: packets)
+			draw_packet(p, state, permutations);
+
+		if(conditional)
+			queries->end();
+	}
+
+	// Draws the instances left by the last instances.cull(), with one
+	// instanced call per material range and PhongInstanced.vert.
+	void draw(InstanceList& instances) const{
+		if(instances.count() == 0)
+			return;
+		prepare();
+
+		DrawState state;
+		bind_vertex_array(instances.vertex_array(vertex_buffer(), index_buffer()));
+		for(const DrawPacket& p: packets)
+			draw_packet(p, state, instances.permutations, instances.count());
+	}
+
+	// Adds one item per material range to queue, keyed by its state and
+	// by the view space depth of the center of the mesh. Packets are only
+	// compiled here (in prepare), never while the queue is drawn.
+	void enqueue(RenderQueue& queue, mat4 View) const{
+		prepare();
+		vec4 center = View*(Model*toVec4(0.5*(bbox_min + bbox_max), 1));
+
+		for(unsigned int i = 0; i < packets.size(); i++){
+			const DrawPacket& p = packets[i];
+			RenderQueue::Pass pass = (p.key & ShaderPermutations::ALPHA_TEST)? 
+				RenderQueue::ALPHA_TESTED_PASS: RenderQueue::OPAQUE_PASS;
+			uint64_t key = RenderQueue::make_key(pass, permutations? p.key: 0, 
+				queue.texture_set(p.textures), vertex_array(), -center.z);
+			queue.add(key, this, i, packets_version);
+		}
+	}
+
+	// Draws the items of a sorted queue in order, after transforms were
+	// updated. The meshes of one queue must all use the same 
+	// ShaderPermutations, or all draw with the current program.
+	//
+	// A mesh with an occlusion query is tested at its first item, and
+	// each of its items is drawn conditionally on that test.
+	static void draw(const RenderQueue& queue){
+		static unsigned int queue_pass = 0;
+		queue_pass++;
+
+		DrawState state;
+		for(unsigned int i = 0; i < queue.size(); i++){
+			const GLMesh& mesh = *queue[i].mesh;
+			// recompiled after it was enqueued (drawn on its own in
+			// between): the packet index may name another range
+			if(queue[i].version != mesh.packets_version)
+				continue;
+
+			if(mesh.queries && mesh.query_queue_pass != queue_pass){
+				mesh.query_queue_pass = queue_pass;
+				mesh.query_issued = mesh.queries->test(mesh.query, mesh.query_pending, 
+					mesh.transform, mesh.bbox_min, mesh.bbox_max);
+			}
+			bool conditional = mesh.queries && mesh.query_issued;
+			if(conditional)
+				mesh.queries->begin(mesh.query);
+
+			mesh.transform.bind();
+			bind_vertex_array(mesh.vertex_array());
+			mesh.draw_packet(mesh.packets[queue[i].packet], state, mesh.permutations);
+
+			if(conditional)
+				mesh.queries->end();
+		}
+	}
+};
+
+#endif
@@ -4,8 +4,19 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <cstring>
+#include <chrono>
 
 #include "GLutils.h"
+#include "QOI.h"
+#include "Hash.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -39,20 +50,35 @@ std::string loadSource(std::string file){
 
 Shader::Shader(std::string file, GLenum shader_type){
 	type = shader_type;
+	this->file = file;
+	source = loadSource(file);
+}
 
-	std::string s = loadSource(file);
-	const char* source = s.c_str();
+Shader Shader::with_defines(const std::vector<std::string>& defines) const{
+	std::string lines;
+	for(const std::string& d: defines)
+		lines += "#define " + d + "\n";
 
-	id = glCreateShader(type);
-	glShaderSource(id, 1, &source, NULL);
-	glCompileShader(id);
+	Shader res = *this;
+	size_t pos = 0;
+	if(source.compare(0, 8, "#version") == 0){
+		pos = source.find('\n');
+		pos = (pos == std::string::npos)? source.size(): pos+1;
+	}
+	res.source.insert(pos, lines);
+	return res;
+}
 
-	deleter = glDeleteShader;
-	
-	check();	
+unsigned int Shader::compile() const{
+	const char* src = source.c_str();
+
+	unsigned int id = glCreateShader(type);
+	glShaderSource(id, 1, &src, NULL);
+	glCompileShader(id);
+	return id;
 }
 
-void Shader::check(){
+bool Shader::check(unsigned int id) const{
 	int  success;
 	glGetShaderiv(id, GL_COMPILE_STATUS, &success);
 	if(success == GL_FALSE){
@@ -70,12 +96,148 @@ void Shader::check(){
 			(type==GL_COMPUTE_SHADER)? "COMPUTE": 
 			"UNKNOWN";
 		std::cerr << "ERROR::SHADER::" << shaderType << 
-			"::COMPILATION_FAILED\n" << infoLog << std::endl;
+			"::COMPILATION_FAILED " << file << "\n" << infoLog << std::endl;
 	}
+	return success == GL_TRUE;
 }
 	
 ////////////////////////////////////////////////////////////////////
-void ShaderProgram::check(){
+GLState gl_state;
+
+void GLState::forget_vao(unsigned int id){
+	if(vao == id)
+		vao = 0;
+}
+
+void GLState::forget_texture(unsigned int id){
+	for(auto& unit: textures)
+		for(unsigned int& t: unit)
+			if(t == id)
+				t = 0;
+}
+
+void GLState::forget_buffer(unsigned int id){
+	for(unsigned int& b: buffers)
+		if(b == id)
+			b = 0;
+	for(Range& r: uniform_ranges)
+		if(r.buffer == id)
+			r = {};
+}
+
+static std::map<unsigned int, ProgramReflection> reflections;
+
+// most lookups are for the same program as the previous one
+static unsigned int last_program = 0;
+static const ProgramReflection* last_reflection = nullptr;
+
+const ProgramReflection& program_reflection(unsigned int program){
+	static const ProgramReflection empty;
+	if(program == last_program && last_reflection)
+		return *last_reflection;
+
+	auto it = reflections.find(program);
+	if(it == reflections.end())
+		return empty;
+	last_program = program;
+	last_reflection = &it->second;
+	return it->second;
+}
+
+int uniform_location(unsigned int program, UniformName name){
+	const ProgramReflection& r = program_reflection(program);
+	if(r.reflected)
+		return r.location(name.hash);
+
+	// not created with ShaderProgram: each name is asked once, and the
+	// answer (-1 included) is kept in a reflection of its own
+	ProgramReflection& own = reflections[program];
+	auto it = own.locations.find(name.hash);
+	if(it != own.locations.end())
+		return it->second;
+	int location = glGetUniformLocation(program, name.name);
+	own.locations[name.hash] = location;
+	return location;
+}
+
+bool ProgramReflection::is_sampler(GLenum type) const{
+	switch(type){
+		case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+		case GL_SAMPLER_1D_SHADOW: case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_CUBE_SHADOW:
+		case GL_SAMPLER_1D_ARRAY: case GL_SAMPLER_2D_ARRAY: 
+		case GL_SAMPLER_1D_ARRAY_SHADOW: case GL_SAMPLER_2D_ARRAY_SHADOW:
+		case GL_SAMPLER_2D_MULTISAMPLE: case GL_SAMPLER_2D_MULTISAMPLE_ARRAY:
+		case GL_SAMPLER_BUFFER: case GL_SAMPLER_2D_RECT: case GL_SAMPLER_2D_RECT_SHADOW:
+		case GL_INT_SAMPLER_2D: case GL_INT_SAMPLER_2D_ARRAY: 
+		case GL_UNSIGNED_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+			return true;
+		default:
+			return false;
+	}
+}
+
+unsigned int uniform_block_binding(const std::string& name){
+	static std::map<std::string, unsigned int> bindings;
+	auto it = bindings.find(name);
+	if(it != bindings.end())
+		return it->second;
+	unsigned int binding = bindings.size();
+	bindings[name] = binding;
+	return binding;
+}
+
+void ShaderProgram::reflect(){
+	if(id == 0)
+		return;
+
+	ProgramReflection& r = reflections[id];
+	r.uniforms.clear();
+	r.locations.clear();
+	r.reflected = true;
+
+	GLint count = 0, max_length = 0;
+	glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+	std::vector<char> name(max_length + 1);
+	for(int i = 0; i < count; i++){
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(id, i, name.size(), NULL, &size, &type, name.data());
+		int location = glGetUniformLocation(id, name.data());
+		r.uniforms.push_back({name.data(), type, size, location});
+		r.locations[name_hash(name.data())] = location;
+
+		std::string s = name.data();
+		if(size > 1 && s.size() > 3 && s.compare(s.size()-3, 3, "[0]") == 0){
+			std::string base = s.substr(0, s.size()-3);
+			r.locations[name_hash(base.c_str())] = location;
+			for(int k = 1; k < size; k++){
+				std::string element = base + "[" + std::to_string(k) + "]";
+				r.locations[name_hash(element.c_str())] = glGetUniformLocation(id, element.c_str());
+			}
+		}
+	}
+
+	GLint n_blocks = 0;
+	glGetProgramiv(id, GL_ACTIVE_UNIFORM_BLOCKS, &n_blocks);
+	for(int i = 0; i < n_blocks; i++){
+		GLint length = 0;
+		glGetActiveUniformBlockiv(id, i, GL_UNIFORM_BLOCK_NAME_LENGTH, &length);
+		std::vector<char> block(length + 1);
+		glGetActiveUniformBlockName(id, i, block.size(), NULL, block.data());
+		glUniformBlockBinding(id, i, uniform_block_binding(block.data()));
+	}
+}
+
+void ShaderProgram::forget_reflection(unsigned int id){
+	reflections.erase(id);
+	if(last_program == id)
+		last_reflection = nullptr;
+}
+
+////////////////////////////////////////////////////////////////////
+bool ShaderProgram::check(){
 	GLint success = 0;
 	glGetProgramiv(id, GL_LINK_STATUS, &success);
 	if(success == GL_FALSE){
@@ -87,57 +249,642 @@ void ShaderProgram::check(){
 		glGetProgramInfoLog(id, maxLength, NULL, infoLog);
 
 		std::cerr << "ERROR::LINK_FAILED\n" << infoLog << '\n';
-		// The program is useless now. So delete it.
+		// The program is useless now. So delete it, and forget it, so that
+		// it is neither reflected nor deleted again.
 		glDeleteProgram(id);
+		id = 0;
 	}
+	return success == GL_TRUE;
 }
 
 ////////////////////////////////////////////////////////////////////
-void load_texture_data(GLenum target, std::string filename){
-	int width, height, nrChannels;
-	unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrChannels, 0);
+std::string ShaderProgram::binary_cache_dir = "shader_cache";
 
-	if(data == NULL){
-		std::cout << "ERROR: could not read texture " << filename << '\n';
+static bool program_binary_supported(){
+	static int formats = -1;
+	if(formats < 0){
+		formats = 0;
+		if(GLEW_ARB_get_program_binary)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	}
+	return formats > 0;
+}
+
+static void make_directory(const std::string& dir){
+#ifdef _WIN32
+	_mkdir(dir.c_str());
+#else
+	mkdir(dir.c_str(), 0755);
+#endif
+}
+
+static bool parallel_shader_compile(){
+	static int parallel = -1;
+	if(parallel < 0){
+		parallel = 0;
+		// let the driver choose the number of threads
+		if(GLEW_KHR_parallel_shader_compile){
+			glMaxShaderCompilerThreadsKHR(0xffffffff);
+			parallel = 1;
+		}else if(GLEW_ARB_parallel_shader_compile){
+			glMaxShaderCompilerThreadsARB(0xffffffff);
+			parallel = 1;
+		}
+	}
+	return parallel;
+}
+
+void ShaderProgram::create(){
+	*this = ShaderProgram{}; // releases the previous program
+	id = glCreateProgram();
+	deleter = [](unsigned int id){
+		forget_reflection(id);
+		glDeleteProgram(id);
+	};
+}
+
+ShaderProgram::PendingLink ShaderProgram::submit(const std::vector<const Shader*>& shaders){
+	parallel_shader_compile();
+
+	PendingLink link;
+	for(const Shader* s: shaders)
+		link.stages.push_back(*s);
+
+	if(binary_cache_dir != "" && program_binary_supported()){
+		uint64_t key = 0;
+		for(GLenum e: {GL_VENDOR, GL_RENDERER, GL_VERSION})
+			key = hash64(std::string((const char*)glGetString(e)), key);
+		for(const Shader* s: shaders){
+			key = hash64(&s->type, sizeof(s->type), key);
+			key = hash64(s->source, key);
+		}
+		char name[32];
+		snprintf(name, sizeof name, "/%016llx.bin", (unsigned long long)key);
+		link.cache_file = binary_cache_dir + name;
+
+		link.from_binary = load_binary(link.cache_file);
+		if(link.from_binary)
+			return link;
+	}
+
+	compile_and_link(link);
+	return link;
+}
+
+void ShaderProgram::compile_and_link(PendingLink& link){
+	for(const Shader& s: link.stages){
+		link.compiled.push_back(s.compile());
+		glAttachShader(id, link.compiled.back());
+	}
+	if(link.cache_file != "")
+		glProgramParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(id);
+}
+
+bool ShaderProgram::completed() const{
+	if(!parallel_shader_compile())
+		return true;
+	GLint done = GL_TRUE;
+	glGetProgramiv(id, GL_COMPLETION_STATUS_KHR, &done);
+	return done == GL_TRUE;
+}
+
+void ShaderProgram::finish(PendingLink& link){
+	if(link.from_binary){
+		GLint success = 0;
+		glGetProgramiv(id, GL_LINK_STATUS, &success);
+		if(success == GL_TRUE){
+			reflect();
+			return;
+		}
+		// a driver update may reject the binary, link from source then
+		link.from_binary = false;
+		compile_and_link(link);
+	}
+
+	for(unsigned int i = 0; i < link.compiled.size(); i++){
+		link.stages[i].check(link.compiled[i]);
+		glDetachShader(id, link.compiled[i]);
+		glDeleteShader(link.compiled[i]);
+	}
+	link.compiled.clear();
+
+	if(!check())
+		return;
+	if(link.cache_file != "")
+		save_binary(link.cache_file);
+	reflect();
+}
+
+bool ShaderBatch::ready() const{
+	for(const Entry& e: pending)
+		if(!e.program->completed())
+			return false;
+	return true;
+}
+
+void ShaderBatch::finish(){
+	for(Entry& e: pending)
+		e.program->finish(e.link);
+	pending.clear();
+}
+
+// Only submits the binary, finish() checks whether the driver accepted it.
+bool ShaderProgram::load_binary(const std::string& file){
+	std::ifstream in(file, std::ios::binary);
+	GLenum format;
+	if(!in.read((char*)&format, sizeof format))
+		return false;
+	std::vector<char> binary{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+	glProgramBinary(id, format, binary.data(), binary.size());
+	return true;
+}
+
+void ShaderProgram::save_binary(const std::string& file){
+	GLint length = 0;
+	glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &length);
+	if(length <= 0)
 		return;
+
+	std::vector<char> binary(length);
+	GLenum format;
+	glGetProgramBinary(id, length, NULL, &format, binary.data());
+
+	make_directory(binary_cache_dir);
+	std::ofstream out(file, std::ios::binary);
+	out.write((const char*)&format, sizeof format);
+	out.write(binary.data(), binary.size());
+}
+
+////////////////////////////////////////////////////////////////////
+void flip_rows(unsigned char* pixels, int width, int height, int channels){
+	size_t row_size = (size_t)width*channels;
+	std::vector<unsigned char> tmp(row_size);
+	for(int i = 0, j = height-1; i < j; i++, j--){
+		unsigned char* a = pixels + i*row_size;
+		unsigned char* b = pixels + j*row_size;
+		memcpy(tmp.data(), a, row_size);
+		memcpy(a, b, row_size);
+		memcpy(b, tmp.data(), row_size);
+	}
+}
+
+Image downsample(const Image& img){
+	Image res;
+	res.width = std::max(1, img.width/2);
+	res.height = std::max(1, img.height/2);
+	res.channels = img.channels;
+	res.pixels.reset((unsigned char*)malloc(res.size()));
+
+	int c = img.channels;
+	const unsigned char* src = img.pixels.get();
+	unsigned char* dst = res.pixels.get();
+	for(int y = 0; y < res.height; y++){
+		int y0 = std::min(2*y, img.height-1);
+		int y1 = std::min(2*y+1, img.height-1);
+		for(int x = 0; x < res.width; x++){
+			int x0 = std::min(2*x, img.width-1);
+			int x1 = std::min(2*x+1, img.width-1);
+			const unsigned char* p00 = src + ((size_t)y0*img.width + x0)*c;
+			const unsigned char* p01 = src + ((size_t)y0*img.width + x1)*c;
+			const unsigned char* p10 = src + ((size_t)y1*img.width + x0)*c;
+			const unsigned char* p11 = src + ((size_t)y1*img.width + x1)*c;
+			for(int k = 0; k < c; k++)
+				*dst++ = (p00[k] + p01[k] + p10[k] + p11[k] + 2)/4;
+		}
+	}
+	return res;
+}
+
+static std::vector<unsigned char> read_file(const std::string& filename){
+	std::ifstream in(filename, std::ios::binary | std::ios::ate);
+	std::vector<unsigned char> data;
+	if(!in)
+		return data;
+	data.resize(in.tellg());
+	in.seekg(0);
+	in.read((char*)data.data(), data.size());
+	return data;
+}
+
+Image decode_image(const unsigned char* data, size_t size, bool flip){
+	Image img;
+
+	QOIDesc desc;
+	if(qoi_read_header(data, size, desc)){
+		img.pixels.reset(qoi_decode(data, size, desc, 0, flip));
+		img.width = desc.width;
+		img.height = desc.height;
+		img.channels = desc.channels;
+		return img;
 	}
 
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	int format[] = {0, GL_RED, GL_RG, GL_RGB, GL_RGBA};
-	glTexImage2D(target, 0, GL_RGBA, width, height, 0, 
-		format[nrChannels], GL_UNSIGNED_BYTE, data);
+	// stb's flip flag is global state, flip here so loading is thread safe
+	img.pixels.reset(stbi_load_from_memory(data, size, &img.width, &img.height, &img.channels, 0));
+	if(img && flip)
+		flip_rows(img.pixels.get(), img.width, img.height, img.channels);
+	return img;
+}
 
-	stbi_image_free(data);
+Image load_image(std::string filename, bool flip){
+	std::vector<unsigned char> data = read_file(filename);
+	return decode_image(data.data(), data.size(), flip);
+}
+
+bool image_info(std::string filename, int& width, int& height, int& channels){
+	if(is_qoi_file(filename)){
+		unsigned char header[14];
+		std::ifstream in(filename, std::ios::binary);
+		in.read((char*)header, sizeof header);
+
+		QOIDesc desc;
+		// qoi_read_header also checks room for the end marker
+		if(!in || !qoi_read_header(header, sizeof header + 8, desc))
+			return false;
+		width = desc.width;
+		height = desc.height;
+		channels = desc.channels;
+		return true;
+	}
+	return stbi_info(filename.c_str(), &width, &height, &channels);
 }
 
 ////////////////////////////////////////////////////////////////////
-void GLTexture::load(std::string filename, GLenum target){
+GLenum pixel_format(int channels){
+	static const GLenum formats[] = {0, GL_RED, GL_RG, GL_RGB, GL_RGBA};
+	return formats[channels];
+}
+
+static GLenum binding_target(GLenum target){
+	if(target >= GL_TEXTURE_CUBE_MAP_POSITIVE_X && target <= GL_TEXTURE_CUBE_MAP_NEGATIVE_Z)
+		return GL_TEXTURE_CUBE_MAP;
+	return target;
+}
+
+////////////////////////////////////////////////////////////////////
+TexturePolicy texture_policy;
+
+GLenum TexturePolicy::internal_format(int channels, TextureUsage usage) const{
+	bool color_srgb = srgb && usage == TextureUsage::Color;
+	switch(channels){
+		case 1: return GL_R8;
+		case 2: return GL_RG8;
+		case 3: return color_srgb? GL_SRGB8: GL_RGB8;
+		default: return color_srgb? GL_SRGB8_ALPHA8: GL_RGBA8;
+	}
+}
+
+size_t TexturePolicy::bytes_per_texel(GLenum internal_format){
+	switch(internal_format){
+		case GL_R8: return 1;
+		case GL_RG8: return 2;
+		// drivers usually pad 3 channel formats to 4 bytes
+		default: return 4;
+	}
+}
+
+Image TexturePolicy::fit(Image img, TextureUsage usage) const{
+	int max = max_size();
+	while(max > 0 && std::max(img.width, img.height) > max)
+		img = downsample(img);
+
+	if(budget > 0)
+		while(used + bytes(img.width, img.height, img.channels, usage) > budget &&
+		      std::max(img.width, img.height) > 1)
+			img = downsample(img);
+
+	return img;
+}
+
+void TexturePolicy::account(unsigned int texture, size_t bytes){
+	allocations[texture] += bytes;
+	used += bytes;
+}
+
+void TexturePolicy::release(unsigned int texture){
+	auto it = allocations.find(texture);
+	if(it == allocations.end())
+		return;
+	used -= it->second;
+	allocations.erase(it);
+}
+
+void set_gray_swizzle(GLenum target, int channels){
+	if(channels == 1){
+		GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+		glTexParameteriv(target, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+	}else if(channels == 2){
+		GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_GREEN};
+		glTexParameteriv(target, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+	}
+}
+
+////////////////////////////////////////////////////////////////////
+void upload_texture_data(GLenum target, const Image& img, TextureUsage usage){
+	pixel_alignment(GL_UNPACK_ALIGNMENT, 1);
+	GLenum internal_format = texture_policy.internal_format(img.channels, usage);
+	glTexImage2D(target, 0, internal_format, img.width, img.height, 0, 
+		pixel_format(img.channels), GL_UNSIGNED_BYTE, img.pixels.get());
+	set_gray_swizzle(binding_target(target), img.channels);
+}
+
+////////////////////////////////////////////////////////////////////
+void GLTexture::load(std::string filename, GLenum target, TextureUsage usage){
 	if(target == 0)
 		target = this->target;
 
-	glBindTexture(target, id);
-
 	bool flip = (target == GL_TEXTURE_2D);
-	stbi_set_flip_vertically_on_load(flip);
-	load_texture_data(target, filename);
-}
-/*
+	Image img = load_image(filename, flip);
 
-unsigned int loadCubemap(std::string texture_faces[6]){
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-	
-	stbi_set_flip_vertically_on_load(false);
-	for(int i = 0; i < 6; i++)
-		load_texture_data(GL_TEXTURE_CUBE_MAP_POSITIVE_X+i, texture_faces[i]);
+	if(!img){
+		std::cout << "ERROR: could not read texture " << filename << '\n';
+		return;
+	}
 
+	load(img, target, usage);
+}
+
+void set_cubemap_params(){
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);  
+}
+
+void GLTexture::load_cubemap(const std::array<std::string, 6>& faces){
+	// decode the six faces in parallel, upload them on this thread
+	std::array<std::future<Image>, 6> decoded;
+	for(int i = 0; i < 6; i++)
+		decoded[i] = std::async(std::launch::async, load_image, faces[i], false);
+
+	for(int i = 0; i < 6; i++){
+		Image img = decoded[i].get();
+		if(!img){
+			std::cout << "ERROR: could not read texture " << faces[i] << '\n';
+			continue;
+		}
+		load(img, GL_TEXTURE_CUBE_MAP_POSITIVE_X+i);
+	}
+
+	bind_texture(GL_TEXTURE_CUBE_MAP, id);
+	set_cubemap_params();
+}
+
+void GLTexture::load(const Image& image, GLenum target, TextureUsage usage){
+	if(target == 0)
+		target = this->target;
+
+	// cube map faces add up, a 2D texture replaces its previous contents
+	if(binding_target(target) == target)
+		texture_policy.release(id);
+
+	Image img = texture_policy.fit(Image{image.width, image.height, image.channels, 
+		{image.pixels.get(), [](void*){}}}, usage);
+
+	bind_texture(binding_target(target), id);
+	upload_texture_data(target, img, usage);
+	texture_policy.account(id, texture_policy.bytes(img.width, img.height, img.channels, usage));
+}
+
+////////////////////////////////////////////////////////////////////
+TextureCache texture_cache;
+
+std::shared_ptr<GLTexture> TextureCache::get(const std::string& filename, TextureUsage usage, 
+		const Factory& create){
+	PathKey path{filename, usage};
+	auto it = by_path.find(path);
+	if(it != by_path.end())
+		if(std::shared_ptr<GLTexture> texture = it->second.lock())
+			return texture;
+
+	std::vector<unsigned char> data = read_file(filename);
+	if(data.empty())
+		return nullptr;
+
+	// identical hash and size is taken as identical contents
+	ContentKey key{hash64(data.data(), data.size()), data.size(), usage};
+	Entry& entry = by_content[key];
+	if(std::shared_ptr<GLTexture> texture = entry.texture.lock()){
+		if(entry.file != filename)
+			duplicates.push_back({filename, entry.file, usage});
+		by_path[path] = texture;
+		return texture;
+	}
+
+	Image img = decode_image(data.data(), data.size(), true);
+	if(!img){
+		by_content.erase(key);
+		return nullptr;
+	}
+
+	auto texture = std::make_shared<GLTexture>(create(img, usage));
+	entry = {filename, texture};
+	by_path[path] = texture;
+	return texture;
+}
+
+void TextureCache::report() const{
+	size_t saved = 0;
+	for(const Duplicate& d: duplicates){
+		size_t bytes = 0;
+		auto it = by_path.find({d.original, d.usage});
+		if(it != by_path.end())
+			if(std::shared_ptr<GLTexture> texture = it->second.lock()){
+				auto a = texture_policy.allocations.find(*texture);
+				if(a != texture_policy.allocations.end())
+					bytes = a->second;
+			}
+		std::cout << d.file << " == " << d.original << " (" << bytes/1024 << " KiB)\n";
+		saved += bytes;
+	}
+	std::cout << duplicates.size() << " duplicate textures, " 
+		<< saved/(1024*1024.0) << " MiB saved\n";
+}
+
+////////////////////////////////////////////////////////////////////
+TextureUploader::TextureUploader(size_t slot_size, int n_slots) : slot_size{slot_size}{
+	slots.resize(n_slots);
+	persistent = GLEW_ARB_buffer_storage;
+
+	for(Slot& slot: slots){
+		glGenBuffers(1, &slot.pbo);
+		bind_buffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+		if(persistent){
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_PIXEL_UNPACK_BUFFER, slot_size, NULL, flags);
+			slot.ptr = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slot_size, flags);
+		}else{
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, slot_size, NULL, GL_STREAM_DRAW);
+		}
+	}
+	bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+TextureUploader::~TextureUploader(){
+	release();
+}
+
+TextureUploader& TextureUploader::operator=(TextureUploader&& other){
+	if(&other != this){
+		release();
+		budget_bytes = other.budget_bytes;
+		budget_ms = other.budget_ms;
+		frame_stats = other.frame_stats;
+		slots = std::move(other.slots);
+		other.slots.clear();
+		slot_size = other.slot_size;
+		current = other.current;
+		persistent = other.persistent;
+		pending = std::move(other.pending);
+		decoding = std::move(other.decoding);
+	}
+	return *this;
+}
+
+void TextureUploader::release(){
+	for(Slot& slot: slots){
+		if(slot.fence)
+			glDeleteSync(slot.fence);
+		// deleting a buffer also unmaps it
+		if(slot.pbo){
+			gl_state.forget_buffer(slot.pbo);
+			glDeleteBuffers(1, &slot.pbo);
+		}
+	}
+	slots.clear();
+}
+
+void TextureUploader::upload(unsigned int texture, GLenum target, int level, Image img,
+		TextureUsage usage, std::function<void(unsigned int)> on_done){
+	if(!img)
+		return;
+
+	int format = pixel_format(img.channels);
+	GLenum internal_format = texture_policy.internal_format(img.channels, usage);
+	bind_texture(binding_target(target), texture);
+	glTexImage2D(target, level, internal_format, img.width, img.height, 0, 
+		format, GL_UNSIGNED_BYTE, NULL);
+	set_gray_swizzle(binding_target(target), img.channels);
+
+	Job job{texture, target, level, std::move(img)};
+	job.on_done = on_done;
+	pending.push_back(std::move(job));
+}
+
+void TextureUploader::load(unsigned int texture, GLenum target, std::string filename,
+		TextureUsage usage, std::function<void(unsigned int)> on_done){
+	bool flip = (target == GL_TEXTURE_2D);
+	Decode d{texture, target, usage, filename, std::async(std::launch::async, load_image, filename, flip)};
+	d.on_done = on_done;
+	decoding.push_back(std::move(d));
+}
+
+// The rows not uploaded yet, synchronously from client memory.
+void TextureUploader::upload_rest(Job& job){
+	pixel_alignment(GL_UNPACK_ALIGNMENT, 1);
+
+	size_t row_size = (size_t)job.img.width*job.img.channels;
+	bind_texture(binding_target(job.target), job.texture);
+	glTexSubImage2D(job.target, job.level, 0, job.next_row, job.img.width, job.img.height - job.next_row,
+		pixel_format(job.img.channels), GL_UNSIGNED_BYTE, job.img.pixels.get() + job.next_row*row_size);
+
+	frame_stats.bytes += (job.img.height - job.next_row)*row_size;
+	job.next_row = job.img.height;
+}
+
+bool TextureUploader::upload_band(Job& job, size_t max_bytes){
+	size_t row_size = (size_t)job.img.width*job.img.channels;
+	// a single row larger than a slot can not be streamed
+	if(row_size > slot_size){
+		upload_rest(job);
+		return true;
+	}
+
+	Slot& slot = slots[current];
+	if(slot.fence){
+		GLenum res = glClientWaitSync(slot.fence, 0, 0);
+		if(res == GL_TIMEOUT_EXPIRED)
+			return false;
+		glDeleteSync(slot.fence);
+		slot.fence = 0;
+	}
+
+	int rows = std::min<size_t>(max_bytes, slot_size)/row_size;
+	rows = std::max(1, std::min(rows, job.img.height - job.next_row));
+	size_t bytes = rows*row_size;
+
+	const unsigned char* src = job.img.pixels.get() + job.next_row*row_size;
+	bind_buffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+	if(persistent){
+		memcpy(slot.ptr, src, bytes);
+	}else{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+		void* ptr = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, flags);
+		memcpy(ptr, src, bytes);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	}
+
+	pixel_alignment(GL_UNPACK_ALIGNMENT, 1);
+	bind_texture(binding_target(job.target), job.texture);
+	glTexSubImage2D(job.target, job.level, 0, job.next_row, job.img.width, rows,
+		pixel_format(job.img.channels), GL_UNSIGNED_BYTE, (void*)0);
+	bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-	return textureID;
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	current = (current + 1) % slots.size();
+
+	job.next_row += rows;
+	frame_stats.bytes += bytes;
+	frame_stats.bands++;
+	return true;
+}
+
+void TextureUploader::update(){
+	using Clock = std::chrono::steady_clock;
+	auto start = Clock::now();
+	frame_stats = {};
+
+	while(!decoding.empty() && 
+	      decoding.front().image.wait_for(std::chrono::seconds(0)) == std::future_status::ready){
+		Decode d = std::move(decoding.front());
+		decoding.pop_front();
+
+		Image img = d.image.get();
+		if(!img){
+			std::cout << "ERROR: could not read texture " << d.filename << '\n';
+			continue;
+		}
+		img = texture_policy.fit(std::move(img), d.usage);
+		upload(d.texture, d.target, 0, std::move(img), d.usage, d.on_done);
+	}
+
+	if(slots.empty()){
+		// no ring: fall back to synchronous uploads from client memory
+		for(Job& job: pending){
+			upload_rest(job);
+			if(job.on_done)
+				job.on_done(job.texture);
+		}
+		pending.clear();
+		return;
+	}
+
+	while(!pending.empty() && frame_stats.bytes < budget_bytes){
+		double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		if(ms >= budget_ms)
+			break;
+
+		Job& job = pending.front();
+		if(!upload_band(job, budget_bytes - frame_stats.bytes)){
+			frame_stats.stalls++;
+			break;
+		}
+
+		if(job.next_row == job.img.height){
+			if(job.on_done)
+				job.on_done(job.texture);
+			pending.pop_front();
+		}
+	}
 }
-*/
@@ -7,6 +7,14 @@
 #include <iostream>
 #include <array>
 #include <functional>
+#include <memory>
+#include <cstdlib>
+#include <deque>
+#include <future>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <cstdint>
 
 #include "vec.h"
 #include "matrix.h"
@@ -16,71 +24,355 @@
 void enable_debug();
 
 ////////////////////////////////////////////////////////////////////
+// Shadow of the GL state this code changes. Reading state back with
+// glGet* would stall on the driver, and calls that would not change
+// anything are skipped. Change this state only through the functions
+// below (use_program, bind_texture, enable, ...).
+struct GLState{
+	static const int max_units = 16;
+	static const int max_buffer_bindings = 16;
+
+	unsigned int program = 0;
+	unsigned int vao = 0;
+	int active_unit = 0;
+	// GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_CUBE_MAP and GL_TEXTURE_3D of each unit
+	unsigned int textures[max_units][4] = {};
+	// GL_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_PIXEL_UNPACK_BUFFER, GL_DRAW_INDIRECT_BUFFER
+	unsigned int buffers[4] = {};
+
+	struct Range{
+		unsigned int buffer = 0;
+		GLintptr offset = 0;
+		GLsizeiptr size = 0;
+	};
+	Range uniform_ranges[max_buffer_bindings];
+
+	// GL_DEPTH_TEST, GL_STENCIL_TEST, GL_BLEND, GL_CULL_FACE, GL_SCISSOR_TEST
+	bool enabled[5] = {};
+	GLenum depth_func = GL_LESS;
+	bool depth_mask = true;
+	unsigned int color_mask = 0xf;
+	GLenum stencil_func = GL_ALWAYS;
+	int stencil_ref = 0;
+	unsigned int stencil_func_mask = ~0u;
+	GLenum stencil_op[3] = {GL_KEEP, GL_KEEP, GL_KEEP};
+	unsigned int stencil_mask = ~0u;
+	int unpack_alignment = 4;
+	int pack_alignment = 4;
+
+	struct Stats{
+		int issued = 0;
+		int elided = 0;
+	};
+	Stats frame_stats;  // this frame so far
+	Stats last_frame;
+
+	// true (and counts the call as issued) if value differs from v
+	template<class T>
+	bool changes(T& value, T v){
+		if(value == v){
+			frame_stats.elided++;
+			return false;
+		}
+		value = v;
+		frame_stats.issued++;
+		return true;
+	}
+
+	void new_frame(){
+		last_frame = frame_stats;
+		frame_stats = {};
+	}
+
+	static int texture_index(GLenum target){
+		switch(target){
+			case GL_TEXTURE_2D: return 0;
+			case GL_TEXTURE_2D_ARRAY: return 1;
+			case GL_TEXTURE_CUBE_MAP: return 2;
+			case GL_TEXTURE_3D: return 3;
+			default: return -1;
+		}
+	}
+
+	// the element array binding belongs to the VAO, it is not cached
+	static int buffer_index(GLenum target){
+		switch(target){
+			case GL_ARRAY_BUFFER: return 0;
+			case GL_UNIFORM_BUFFER: return 1;
+			case GL_PIXEL_UNPACK_BUFFER: return 2;
+			case GL_DRAW_INDIRECT_BUFFER: return 3;
+			default: return -1;
+		}
+	}
+
+	static int capability_index(GLenum cap){
+		switch(cap){
+			case GL_DEPTH_TEST: return 0;
+			case GL_STENCIL_TEST: return 1;
+			case GL_BLEND: return 2;
+			case GL_CULL_FACE: return 3;
+			case GL_SCISSOR_TEST: return 4;
+			default: return -1;
+		}
+	}
+
+	// Deleted objects are unbound by GL and their names may be reused.
+	// (A deleted program stays in use until another one is bound.)
+	void forget_vao(unsigned int id);
+	void forget_texture(unsigned int id);
+	void forget_buffer(unsigned int id);
+};
+
+extern GLState gl_state;
+
+inline void use_program(unsigned int program){
+	if(gl_state.changes(gl_state.program, program))
+		glUseProgram(program);
+}
+
 inline int currentProgram(){
-	int program;
-	glGetIntegerv(GL_CURRENT_PROGRAM, &program);	
-	return program;
+	return gl_state.program;
+}
+
+inline void bind_vertex_array(unsigned int vao){
+	if(gl_state.changes(gl_state.vao, vao))
+		glBindVertexArray(vao);
+}
+
+inline void active_texture(int unit){
+	if(gl_state.changes(gl_state.active_unit, unit))
+		glActiveTexture(GL_TEXTURE0 + unit);
+}
+
+// Binds texture to the active unit.
+inline void bind_texture(GLenum target, unsigned int texture){
+	int t = GLState::texture_index(target);
+	int unit = gl_state.active_unit;
+	if(t < 0 || unit >= GLState::max_units){
+		gl_state.frame_stats.issued++;
+		glBindTexture(target, texture);
+	}else if(gl_state.changes(gl_state.textures[unit][t], texture)){
+		glBindTexture(target, texture);
+	}
+}
+
+inline void bind_texture_unit(int unit, GLenum target, unsigned int texture){
+	int t = GLState::texture_index(target);
+	if(t >= 0 && unit < GLState::max_units && gl_state.textures[unit][t] == texture){
+		gl_state.frame_stats.elided++;
+		return;
+	}
+	active_texture(unit);
+	bind_texture(target, texture);
+}
+
+inline void bind_buffer(GLenum target, unsigned int buffer){
+	int b = GLState::buffer_index(target);
+	if(b < 0){
+		gl_state.frame_stats.issued++;
+		glBindBuffer(target, buffer);
+	}else if(gl_state.changes(gl_state.buffers[b], buffer)){
+		glBindBuffer(target, buffer);
+	}
+}
+
+// glBindBufferRange/Base also bind the buffer to the generic target.
+inline void bind_buffer_range(GLenum target, unsigned int index, unsigned int buffer, 
+		GLintptr offset, GLsizeiptr size){
+	if(target == GL_UNIFORM_BUFFER && index < GLState::max_buffer_bindings){
+		GLState::Range& r = gl_state.uniform_ranges[index];
+		if(r.buffer == buffer && r.offset == offset && r.size == size){
+			gl_state.frame_stats.elided++;
+			return;
+		}
+		r = {buffer, offset, size};
+	}
+	gl_state.frame_stats.issued++;
+	glBindBufferRange(target, index, buffer, offset, size);
+	int b = GLState::buffer_index(target);
+	if(b >= 0)
+		gl_state.buffers[b] = buffer;
+}
+
+inline void bind_buffer_base(GLenum target, unsigned int index, unsigned int buffer){
+	if(target == GL_UNIFORM_BUFFER && index < GLState::max_buffer_bindings)
+		gl_state.uniform_ranges[index] = {buffer, 0, -1}; // whole buffer
+	gl_state.frame_stats.issued++;
+	glBindBufferBase(target, index, buffer);
+	int b = GLState::buffer_index(target);
+	if(b >= 0)
+		gl_state.buffers[b] = buffer;
+}
+
+inline void set_enabled(GLenum cap, bool on){
+	int c = GLState::capability_index(cap);
+	if(c < 0){
+		gl_state.frame_stats.issued++;
+	}else if(!gl_state.changes(gl_state.enabled[c], on)){
+		return;
+	}
+	if(on)
+		glEnable(cap);
+	else
+		glDisable(cap);
+}
+
+inline void enable(GLenum cap){ set_enabled(cap, true); }
+inline void disable(GLenum cap){ set_enabled(cap, false); }
+
+inline void depth_func(GLenum func){
+	if(gl_state.changes(gl_state.depth_func, func))
+		glDepthFunc(func);
+}
+
+inline void depth_mask(bool write){
+	if(gl_state.changes(gl_state.depth_mask, write))
+		glDepthMask(write);
+}
+
+inline void color_mask(bool r, bool g, bool b, bool a){
+	unsigned int mask = r | g << 1 | b << 2 | a << 3;
+	if(gl_state.changes(gl_state.color_mask, mask))
+		glColorMask(r, g, b, a);
+}
+
+inline void stencil_func(GLenum func, int ref, unsigned int mask){
+	GLState& s = gl_state;
+	if(s.stencil_func == func && s.stencil_ref == ref && s.stencil_func_mask == mask){
+		s.frame_stats.elided++;
+		return;
+	}
+	s.stencil_func = func;
+	s.stencil_ref = ref;
+	s.stencil_func_mask = mask;
+	s.frame_stats.issued++;
+	glStencilFunc(func, ref, mask);
+}
+
+inline void stencil_op(GLenum sfail, GLenum dpfail, GLenum dppass){
+	GLState& s = gl_state;
+	if(s.stencil_op[0] == sfail && s.stencil_op[1] == dpfail && s.stencil_op[2] == dppass){
+		s.frame_stats.elided++;
+		return;
+	}
+	s.stencil_op[0] = sfail;
+	s.stencil_op[1] = dpfail;
+	s.stencil_op[2] = dppass;
+	s.frame_stats.issued++;
+	glStencilOp(sfail, dpfail, dppass);
+}
+
+inline void stencil_mask(unsigned int mask){
+	if(gl_state.changes(gl_state.stencil_mask, mask))
+		glStencilMask(mask);
+}
+
+// GL_UNPACK_ALIGNMENT or GL_PACK_ALIGNMENT. Images here have tightly
+// packed rows, so uploads and readbacks set 1.
+inline void pixel_alignment(GLenum pname, int alignment){
+	int& value = (pname == GL_PACK_ALIGNMENT)? gl_state.pack_alignment: gl_state.unpack_alignment;
+	if(gl_state.changes(value, alignment))
+		glPixelStorei(pname, alignment);
 }
 
 ////////////////////////////////////////////////////////////////////
+// 64 bit FNV-1a, folded by the optimizer for string literals.
+constexpr uint64_t name_hash(const char* s, uint64_t h = 14695981039346656037ULL){
+	return *s? name_hash(s+1, (h ^ (unsigned char)*s)*1099511628211ULL): h;
+}
 
+struct UniformName{
+	uint64_t hash;
+	const char* name;
+
+	constexpr UniformName(const char* s) : hash{name_hash(s)}, name{s}{}
+	UniformName(const std::string& s) : hash{name_hash(s.c_str())}, name{s.c_str()}{}
+};
+
+// Location from the table built when program was linked (see ProgramReflection).
+int uniform_location(unsigned int program, UniformName name);
+
+////////////////////////////////////////////////////////////////////
+// Uniform{"name"} = value sets a uniform of the program in use.
+// Uniform{program, "name"} = value sets it with glProgramUniform*, 
+// without binding program (binds it if ARB_separate_shader_objects
+// is missing).
 struct Uniform{
 	int loc = -1;
+	unsigned int program = 0;
 
 	Uniform() = default;
 
-	Uniform(std::string var){
-		loc = glGetUniformLocation(currentProgram(), var.c_str());
+	Uniform(UniformName name){
+		loc = uniform_location(gl_state.program, name);
+	}
+
+	Uniform(unsigned int program, UniformName name){
+		loc = uniform_location(program, name);
+		if(GLEW_ARB_separate_shader_objects)
+			this->program = program;
+		else if(program != gl_state.program)
+			use_program(program);
 	}
 
 	Uniform& operator=(int v){
-		glUniform1i(loc, v);
+		if(program) glProgramUniform1i(program, loc, v);
+		else glUniform1i(loc, v);
 		return *this;
 	}
 
 	Uniform& operator=(float v){
-		glUniform1f(loc, v);
+		if(program) glProgramUniform1f(program, loc, v);
+		else glUniform1f(loc, v);
 		return *this;
 	}
 
 	Uniform& operator=(vec2 v){
-		glUniform2fv(loc, 1, &v.x);
+		if(program) glProgramUniform2fv(program, loc, 1, &v.x);
+		else glUniform2fv(loc, 1, &v.x);
 		return *this;
 	}
 
 	Uniform& operator=(vec3 v){
-		glUniform3fv(loc, 1, &v.x);
+		if(program) glProgramUniform3fv(program, loc, 1, &v.x);
+		else glUniform3fv(loc, 1, &v.x);
 		return *this;
 	}
 
 	Uniform& operator=(vec4 v){
-		glUniform4fv(loc, 1, &v.x);
+		if(program) glProgramUniform4fv(program, loc, 1, &v.x);
+		else glUniform4fv(loc, 1, &v.x);
 		return *this;
 	}
 
 	Uniform& operator=(mat2 M){
-		glUniformMatrix2fv(loc, 1, true, &M[0][0]);
+		if(program) glProgramUniformMatrix2fv(program, loc, 1, true, &M[0][0]);
+		else glUniformMatrix2fv(loc, 1, true, &M[0][0]);
 		return *this;
 	}
 
 	Uniform& operator=(mat3 M){
-		glUniformMatrix3fv(loc, 1, true, &M[0][0]);
+		if(program) glProgramUniformMatrix3fv(program, loc, 1, true, &M[0][0]);
+		else glUniformMatrix3fv(loc, 1, true, &M[0][0]);
 		return *this;
 	}
 
 	Uniform& operator=(mat4 M){
-		glUniformMatrix4fv(loc, 1, true, &M[0][0]);
+		if(program) glProgramUniformMatrix4fv(program, loc, 1, true, &M[0][0]);
+		else glUniformMatrix4fv(loc, 1, true, &M[0][0]);
 		return *this;
 	}
 
 	Uniform& operator=(const std::vector<float>& v){
-		glUniform1fv(loc, v.size(), v.data());
+		if(program) glProgramUniform1fv(program, loc, v.size(), v.data());
+		else glUniform1fv(loc, v.size(), v.data());
 		return *this;
 	}
 	
 	template<size_t N>
 	Uniform& operator=(const std::array<vec3, N>& v){
-		glUniform3fv(loc, v.size(), &v[0].x);
+		if(program) glProgramUniform3fv(program, loc, v.size(), &v[0].x);
+		else glUniform3fv(loc, v.size(), &v[0].x);
 		return *this;
 	}
 };
@@ -102,6 +394,7 @@ struct UintResource{
 
 	UintResource(UintResource&& other){
 		id = other.id;
+		deleter = std::move(other.deleter);
 		other.id = 0;
 	}
 
@@ -109,47 +402,154 @@ struct UintResource{
 		if(&other != this){
 			UintResource tmp{std::move(other)};
 			std::swap(id, tmp.id);
+			std::swap(deleter, tmp.deleter);
 		}
 		return *this;
 	}
 };
 
 ////////////////////////////////////////////////////////////////////
-struct Shader : public UintResource{
+// Source of one shader stage. It is compiled when a ShaderProgram is
+// linked, and not at all when the program binary comes from the cache.
+struct Shader{
 	GLenum type;
+	std::string file;
+	std::string source;
+
 	Shader() = default;
 	Shader(std::string file, GLenum shader_type);
-	void check();
+
+	// Copy with "#define d" for each d inserted after the #version line.
+	Shader with_defines(const std::vector<std::string>& defines) const;
+
+	// Returns a new shader object (delete with glDeleteShader).
+	// The compile status is not queried, see check().
+	unsigned int compile() const;
+
+	// Waits for the compilation of id and prints its errors.
+	bool check(unsigned int id) const;
+};
+
+////////////////////////////////////////////////////////////////////
+// Active uniforms of a linked program, queried once at link time.
+struct ProgramReflection{
+	struct UniformInfo{
+		std::string name;
+		GLenum type;
+		int size;
+		int location;
+	};
+	std::vector<UniformInfo> uniforms;
+	bool reflected = false; // false: a program not made by ShaderProgram
+
+	// name_hash of every uniform name -> location. Array elements are
+	// found both as "a" and "a[i]".
+	struct IdentityHash{
+		size_t operator()(uint64_t h) const{ return h; }
+	};
+	std::unordered_map<uint64_t, int, IdentityHash> locations;
+
+	int location(uint64_t hash) const{
+		auto it = locations.find(hash);
+		return (it != locations.end())? it->second: -1;
+	}
+
+	bool is_sampler(GLenum type) const;
+
+	// true if the program really samples the sampler uniform name
+	bool samples(const std::string& name) const{
+		for(const UniformInfo& u: uniforms)
+			if(u.name == name)
+				return is_sampler(u.type);
+		return false;
+	}
 };
 
+// Reflection of a program created with ShaderProgram (empty otherwise).
+const ProgramReflection& program_reflection(unsigned int program);
+
+// Binding point of the uniform block name, the same for every program.
+// ShaderProgram binds the blocks it declares at link time.
+unsigned int uniform_block_binding(const std::string& name);
+
 ////////////////////////////////////////////////////////////////////
+// Linked programs are saved with glGetProgramBinary in binary_cache_dir,
+// keyed by a hash of the shader sources and of the GL vendor, renderer
+// and version. Later runs load them with glProgramBinary and only
+// compile the sources when there is no binary or the driver rejects it.
 struct ShaderProgram : public UintResource{
+	// empty to disable the cache
+	static std::string binary_cache_dir;
+
 	ShaderProgram() = default;
 	
 	template<class...T>
 	ShaderProgram(const T&... shaders){
-		id = glCreateProgram();
-		deleter = glDeleteProgram;
-		init(shaders...);
+		create();
+		PendingLink link = submit({&shaders...});
+		finish(link);
+	}
+
+	const ProgramReflection& reflection() const{
+		return program_reflection(id);
 	}
 
 	int getAttribLocation(std::string attrib){
 		return glGetAttribLocation(id, attrib.c_str());
 	}
+
+	// false while the driver is still compiling or linking
+	// (always true without KHR/ARB_parallel_shader_compile)
+	bool completed() const;
+
 	private:
-	void init(){
-		glLinkProgram(id);
-		check();
-	}
+	friend struct ShaderBatch;
+
+	// A link submitted to the driver whose status was not queried yet.
+	struct PendingLink{
+		std::vector<Shader> stages;
+		std::vector<unsigned int> compiled;
+		std::string cache_file;
+		bool from_binary = false;
+	};
+
+	void create();
+	PendingLink submit(const std::vector<const Shader*>& shaders);
+	void compile_and_link(PendingLink& link);
+	void finish(PendingLink& link);
+	bool load_binary(const std::string& file);
+	void save_binary(const std::string& file);
+
+	bool check();
+	void reflect();
+	static void forget_reflection(unsigned int id);
+};
+
+////////////////////////////////////////////////////////////////////
+// Compiles and links several programs together. Everything is sent to 
+// the driver first and status is only queried in finish(), so with 
+// KHR/ARB_parallel_shader_compile the driver compiles them on its own 
+// threads; without it the compiler can still overlap with submission.
+// The programs must not be moved or destroyed before finish().
+struct ShaderBatch{
 	template<class...T>
-	void init(const Shader& s, const T&...tail){
-		glAttachShader(id, s);
-		init(tail...);
-		glDetachShader(id, s);
+	void add(ShaderProgram& program, const T&... shaders){
+		program.create();
+		pending.push_back({&program, program.submit({&shaders...})});
 	}
 
+	// true when every program finished compiling (finish() will not block)
+	bool ready() const;
 
-	void check();
+	// Checks every program, prints the errors and reflects the programs.
+	void finish();
+
+	private:
+	struct Entry{
+		ShaderProgram* program;
+		ShaderProgram::PendingLink link;
+	};
+	std::vector<Entry> pending;
 };
 
 ////////////////////////////////////////////////////////////////////
@@ -161,13 +561,14 @@ struct GLBuffer : public UintResource{
 	GLBuffer(GLenum type) : type{type}{
 		glGenBuffers(1, &id);
 		deleter = [](unsigned int id){
+			gl_state.forget_buffer(id);
 			glDeleteBuffers(1, &id);
 		};
 	}
 
 	template<class T>
 	void data(const std::vector<T>& V, GLenum usage){
-		glBindBuffer(type, id);
+		bind_buffer(type, id);
 		glBufferData(type, V.size()*sizeof(T), V.data(), usage);
 	}
 };
@@ -181,11 +582,109 @@ struct VAO : public UintResource{
 		glGenVertexArrays(1, &id);
 		
 		deleter = [](unsigned int id){
+			gl_state.forget_vao(id);
 			glDeleteVertexArrays(1, &id);
 		};
 	}
 };
 
+////////////////////////////////////////////////////////////////////
+struct GLQuery : public UintResource{
+	GLQuery(bool init = false){
+		if(!init)
+			return;
+
+		glGenQueries(1, &id);
+
+		deleter = [](unsigned int id){
+			glDeleteQueries(1, &id);
+		};
+	}
+};
+
+////////////////////////////////////////////////////////////////////
+// Decoded image, rows tightly packed, width*height*channels bytes.
+struct Image{
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+	std::unique_ptr<unsigned char, void(*)(void*)> pixels{nullptr, free};
+
+	size_t size() const{ return (size_t)width*height*channels; }
+	explicit operator bool() const{ return pixels != nullptr; }
+};
+
+// Reads PNG/JPG/... through stb_image and *.qoi through the QOI decoder.
+// With flip = true the rows are stored bottom-up, as OpenGL expects.
+Image load_image(std::string filename, bool flip);
+
+// Same as load_image, from the bytes of an image file in memory.
+Image decode_image(const unsigned char* data, size_t size, bool flip);
+
+// Reads only the image header.
+bool image_info(std::string filename, int& width, int& height, int& channels);
+
+void flip_rows(unsigned char* pixels, int width, int height, int channels);
+
+// Next mip level: half the size (rounded down, at least 1), 2x2 box filter.
+Image downsample(const Image& img);
+
+// GL_RED, GL_RG, GL_RGB or GL_RGBA for 1 to 4 channels.
+GLenum pixel_format(int channels);
+
+inline int mip_levels(int width, int height){
+	int levels = 1;
+	for(int s = std::max(width, height); s > 1; s /= 2)
+		levels++;
+	return levels;
+}
+
+////////////////////////////////////////////////////////////////////
+// Color textures (map_Ka, map_Kd) may be stored as sRGB,
+// data textures (map_Ks, gloss, normal maps) are always linear.
+enum class TextureUsage{ Color, Data };
+
+// Chooses the internal format of textures, limits their resolution
+// by quality tier and keeps count of the texture memory in use.
+struct TexturePolicy{
+	enum Quality{ Low, Medium, High, Ultra };
+	Quality quality = Ultra;
+
+	// Store color textures as SRGB8/SRGB8_ALPHA8.
+	// Only correct when drawing with GL_FRAMEBUFFER_SRGB enabled.
+	bool srgb = false;
+
+	// Bytes of texture memory, 0 for no limit. Textures that would 
+	// exceed it are loaded at a lower resolution.
+	size_t budget = 0;
+	size_t used = 0;
+	std::map<unsigned int, size_t> allocations;
+
+	int max_size() const{
+		const int sizes[] = {512, 1024, 2048, 0};
+		return sizes[quality];
+	}
+
+	GLenum internal_format(int channels, TextureUsage usage) const;
+	static size_t bytes_per_texel(GLenum internal_format);
+
+	// Bytes of an image with its mip chain.
+	size_t bytes(int width, int height, int channels, TextureUsage usage) const{
+		return (size_t)width*height*bytes_per_texel(internal_format(channels, usage))*4/3;
+	}
+
+	// Downscales img to the quality tier and to what is left of the budget.
+	Image fit(Image img, TextureUsage usage) const;
+
+	void account(unsigned int texture, size_t bytes);
+	void release(unsigned int texture);
+};
+
+extern TexturePolicy texture_policy;
+
+// For R8 and RG8 textures, sample the red channel as gray.
+void set_gray_swizzle(GLenum target, int channels);
+
 ////////////////////////////////////////////////////////////////////
 struct GLTexture : public UintResource{
 	GLenum target;
@@ -194,13 +693,145 @@ struct GLTexture : public UintResource{
 
 	GLTexture(GLenum target) : target{target}{
 		glGenTextures(1, &id);
-		glBindTexture(target, id);
+		bind_texture(target, id);
 		deleter = [](unsigned int id){
+			texture_policy.release(id);
+			gl_state.forget_texture(id);
 			glDeleteTextures(1, &id);
 		};
 	}
 
-	void load(std::string filename, GLenum target = 0);
+	void load(std::string filename, GLenum target = 0, TextureUsage usage = TextureUsage::Color);
+	void load(const Image& img, GLenum target = 0, TextureUsage usage = TextureUsage::Color);
+
+	// Faces in the order +X, -X, +Y, -Y, +Z, -Z, decoded in parallel.
+	void load_cubemap(const std::array<std::string, 6>& faces);
+};
+
+void set_cubemap_params();
+
+////////////////////////////////////////////////////////////////////
+// Shares a single GLTexture among image files with identical contents.
+//
+// Files are looked up by path first, so a file already seen costs one
+// map lookup. A new file is read and its bytes hashed before decoding;
+// if a file with the same hash and size was loaded with the same usage,
+// its texture is returned instead of decoding and uploading a copy.
+// The cache holds weak references: textures die with their last user.
+struct TextureCache{
+	// Creates the texture of a decoded image (rows bottom-up).
+	using Factory = std::function<GLTexture(const Image&, TextureUsage)>;
+
+	// nullptr if filename can not be read.
+	std::shared_ptr<GLTexture> get(const std::string& filename, TextureUsage usage, 
+		const Factory& create);
+
+	struct Duplicate{
+		std::string file;
+		std::string original;
+		TextureUsage usage;
+	};
+	std::vector<Duplicate> duplicates;
+
+	// Lists the duplicates found and the texture memory they saved.
+	void report() const;
+
+	private:
+	struct ContentKey{
+		uint64_t hash;
+		size_t size;
+		TextureUsage usage;
+
+		bool operator<(const ContentKey& o) const{
+			if(hash != o.hash) return hash < o.hash;
+			if(size != o.size) return size < o.size;
+			return usage < o.usage;
+		}
+	};
+	struct Entry{
+		std::string file;
+		std::weak_ptr<GLTexture> texture;
+	};
+	// a file may be loaded both as color and as data
+	using PathKey = std::pair<std::string, TextureUsage>;
+	std::map<PathKey, std::weak_ptr<GLTexture>> by_path;
+	std::map<ContentKey, Entry> by_content;
+};
+
+extern TextureCache texture_cache;
+
+////////////////////////////////////////////////////////////////////
+// Streams texture data to the GPU through a ring of pixel buffer 
+// objects, so that glTexSubImage2D reads from GPU memory instead of a 
+// client pointer. Images are cut in bands of rows and each call to 
+// update() uploads at most budget_bytes and spends at most budget_ms.
+// A slot of the ring is only reused after its fence has signaled.
+struct TextureUploader{
+	size_t budget_bytes = 4 << 20;
+	double budget_ms = 2.0;
+
+	TextureUploader() = default;
+	TextureUploader(size_t slot_size, int n_slots = 3);
+	TextureUploader(TextureUploader&& other){ *this = std::move(other); }
+	TextureUploader& operator=(TextureUploader&& other);
+	~TextureUploader();
+
+	// Allocates the texture level and queues its upload.
+	// on_done is called (on the GL thread) after the last band is issued.
+	void upload(unsigned int texture, GLenum target, int level, Image img,
+		TextureUsage usage = TextureUsage::Color, std::function<void(unsigned int)> on_done = {});
+
+	// Decodes filename on a worker thread, then queues its upload,
+	// downscaled by texture_policy.fit().
+	void load(unsigned int texture, GLenum target, std::string filename,
+		TextureUsage usage = TextureUsage::Color, std::function<void(unsigned int)> on_done = {});
+
+	// Call once per frame.
+	void update();
+
+	bool idle() const{ return pending.empty() && decoding.empty(); }
+
+	struct Stats{
+		size_t bytes = 0;
+		int bands = 0;
+		int stalls = 0;     // frames stopped early waiting for a fence
+	}frame_stats;
+
+	private:
+	struct Slot{
+		unsigned int pbo = 0;
+		GLsync fence = 0;
+		unsigned char* ptr = nullptr; // persistent mapping, if available
+	};
+
+	struct Job{
+		unsigned int texture;
+		GLenum target;
+		int level;
+		Image img;
+		int next_row = 0;
+		std::function<void(unsigned int)> on_done;
+	};
+
+	struct Decode{
+		unsigned int texture;
+		GLenum target;
+		TextureUsage usage;
+		std::string filename;
+		std::future<Image> image;
+		std::function<void(unsigned int)> on_done;
+	};
+
+	std::vector<Slot> slots;
+	size_t slot_size = 0;
+	int current = 0;
+	bool persistent = false;
+	std::deque<Job> pending;
+	std::deque<Decode> decoding;
+
+	void release();
+	bool upload_band(Job& job, size_t max_bytes);
+	void upload_rest(Job& job);
 };
 
 #endif
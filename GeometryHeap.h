@@ -0,0 +1,268 @@
+#ifndef GEOMETRY_HEAP_H
+#define GEOMETRY_HEAP_H
+
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include "GLutils.h"
+#include "ObjMesh.h"
+#include "OffsetAllocator.h"
+#include "VertexLayout.h"
+
+class GeometryHeap;
+
+// Vertices (and indices) of one mesh in a GeometryHeap, given back to
+// the heap when the block is destroyed.
+struct GeometryBlock{
+	GeometryHeap* heap = nullptr;
+	unsigned int arena = 0;
+	OffsetAllocator::Allocation vertices;
+	OffsetAllocator::Allocation indices;
+
+	GeometryBlock() = default;
+	GeometryBlock(GeometryBlock&& other){ *this = std::move(other); }
+	GeometryBlock& operator=(GeometryBlock&& other);
+	~GeometryBlock();
+
+	explicit operator bool() const{ return heap != nullptr; }
+
+	bool indexed() const{ return (bool)indices; }
+
+	// VAO of the arena, with the vertex format of GLMesh.
+	unsigned int vao() const;
+	// Offsets to draw with: glDrawElementsBaseVertex for indexed blocks,
+	// glDrawArrays from base_vertex() otherwise.
+	int base_vertex() const;
+	unsigned int first_index() const;
+};
+
+////////////////////////////////////////////////////////////////////
+// Vertex and index data of many meshes in a few large buffers. Each
+// arena is one vertex buffer, one index buffer and the VAO over them;
+// OffsetAllocators hand out ranges of them in constant time, and a
+// freed mesh leaves its range to the next one without creating or
+// deleting GL objects. A new arena is only made when no arena has room.
+//
+// Meshes that share an arena share the VAO, so drawing them one after
+// the other does not rebind vertex state.
+class GeometryHeap{
+	using Vertex = ObjMesh::Vertex;
+
+	struct Arena{
+		VAO vao;
+		GLBuffer vbo;
+		GLBuffer ebo;
+		OffsetAllocator vertices;
+		OffsetAllocator indices;
+	};
+	std::vector<std::unique_ptr<Arena>> arenas;
+	GLBuffer scratch; // for moves within a buffer
+	size_t scratch_size = 0;
+
+	public:
+	unsigned int arena_vertices;
+	unsigned int arena_indices;
+
+	GeometryHeap(unsigned int arena_vertices = 1 << 20, unsigned int arena_indices = 3 << 20)
+		: arena_vertices{arena_vertices}, arena_indices{arena_indices}
+	{}
+
+	GeometryBlock allocate(const std::vector<Vertex>& V, const std::vector<unsigned int>& I = {}){
+		GeometryBlock block;
+		if(V.empty())
+			return block;
+
+		for(unsigned int a = 0; a < arenas.size() && !block; a++)
+			try_allocate(a, V.size(), I.size(), block);
+
+		if(!block){
+			add_arena(std::max<size_t>(arena_vertices, V.size()), std::max<size_t>(arena_indices, I.size()));
+			try_allocate(arenas.size()-1, V.size(), I.size(), block);
+		}
+		if(!block){
+			fprintf(stderr, "GeometryHeap: no room for %zu vertices and %zu indices\n", V.size(), I.size());
+			return block;
+		}
+
+		Arena& arena = *arenas[block.arena];
+		glBindBuffer(GL_COPY_WRITE_BUFFER, arena.vbo);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, block.vertices.offset*sizeof(Vertex),
+			V.size()*sizeof(Vertex), V.data());
+		if(!I.empty()){
+			glBindBuffer(GL_COPY_WRITE_BUFFER, arena.ebo);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, block.indices.offset*sizeof(unsigned int),
+				I.size()*sizeof(unsigned int), I.data());
+		}
+		return block;
+	}
+
+	void free(GeometryBlock& block){
+		if(block.heap != this)
+			return;
+		Arena& arena = *arenas[block.arena];
+		arena.vertices.free(block.vertices);
+		arena.indices.free(block.indices);
+		block.heap = nullptr;
+	}
+
+	// Copies a block back from the GPU, indices relative to its vertices.
+	void read(const GeometryBlock& block, std::vector<Vertex>& V, std::vector<unsigned int>& I) const{
+		const Arena& arena = *arenas[block.arena];
+		V.resize(arena.vertices.size_of(block.vertices));
+		glBindBuffer(GL_COPY_READ_BUFFER, arena.vbo);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, arena.vertices.offset(block.vertices)*sizeof(Vertex),
+			V.size()*sizeof(Vertex), V.data());
+
+		I.clear();
+		if(block.indexed()){
+			I.resize(arena.indices.size_of(block.indices));
+			glBindBuffer(GL_COPY_READ_BUFFER, arena.ebo);
+			glGetBufferSubData(GL_COPY_READ_BUFFER, arena.indices.offset(block.indices)*sizeof(unsigned int),
+				I.size()*sizeof(unsigned int), I.data());
+		}
+	}
+
+	unsigned int vao(const GeometryBlock& block) const{
+		return arenas[block.arena]->vao;
+	}
+
+	unsigned int vertex_buffer(const GeometryBlock& block) const{
+		return arenas[block.arena]->vbo;
+	}
+
+	unsigned int index_buffer(const GeometryBlock& block) const{
+		return arenas[block.arena]->ebo;
+	}
+
+	unsigned int vertex_offset(const GeometryBlock& block) const{
+		return arenas[block.arena]->vertices.offset(block.vertices);
+	}
+
+	unsigned int index_offset(const GeometryBlock& block) const{
+		return arenas[block.arena]->indices.offset(block.indices);
+	}
+
+	// Defragmentation: moves the blocks of every arena to its start, so
+	// that the free space is one range again. Blocks stay valid, with
+	// new offsets; the GL objects are the same.
+	void defragment(){
+		for(auto& arena: arenas){
+			arena->vertices.compact([&](uint32_t from, uint32_t to, uint32_t n){
+				move(arena->vbo, sizeof(Vertex), from, to, n);
+			});
+			arena->indices.compact([&](uint32_t from, uint32_t to, uint32_t n){
+				move(arena->ebo, sizeof(unsigned int), from, to, n);
+			});
+		}
+	}
+
+	void report() const{
+		const double MB = 1024.0*1024.0;
+		for(unsigned int a = 0; a < arenas.size(); a++){
+			OffsetAllocator::Report v = arenas[a]->vertices.report();
+			OffsetAllocator::Report i = arenas[a]->indices.report();
+			printf("Arena %u: %d meshes\n", a, v.allocations);
+			printf("  vertices: %.1f of %.1f MB, %u free ranges, fragmentation %.2f\n",
+				v.used*sizeof(Vertex)/MB, v.size*sizeof(Vertex)/MB, v.free_blocks, v.fragmentation());
+			printf("  indices:  %.1f of %.1f MB, %u free ranges, fragmentation %.2f\n",
+				i.used*sizeof(unsigned int)/MB, i.size*sizeof(unsigned int)/MB, i.free_blocks, i.fragmentation());
+		}
+	}
+
+	private:
+	void try_allocate(unsigned int a, unsigned int n_vertices, unsigned int n_indices, GeometryBlock& block){
+		Arena& arena = *arenas[a];
+		OffsetAllocator::Allocation v = arena.vertices.allocate(n_vertices);
+		if(!v)
+			return;
+		OffsetAllocator::Allocation i;
+		if(n_indices > 0){
+			i = arena.indices.allocate(n_indices);
+			if(!i){
+				arena.vertices.free(v);
+				return;
+			}
+		}
+		block.heap = this;
+		block.arena = a;
+		block.vertices = v;
+		block.indices = i;
+	}
+
+	void add_arena(size_t n_vertices, size_t n_indices){
+		arenas.emplace_back(new Arena);
+		Arena& arena = *arenas.back();
+		arena.vertices = OffsetAllocator(n_vertices);
+		arena.indices = OffsetAllocator(n_indices);
+
+		arena.vao = VAO{true};
+		bind_vertex_array(arena.vao);
+
+		arena.vbo = GLBuffer{GL_ARRAY_BUFFER};
+		bind_buffer(GL_ARRAY_BUFFER, arena.vbo);
+		glBufferData(GL_ARRAY_BUFFER, n_vertices*sizeof(Vertex), NULL, GL_STATIC_DRAW);
+		vertex_layout(arena.vbo);
+
+		// the element array binding is part of the VAO
+		arena.ebo = GLBuffer{GL_ELEMENT_ARRAY_BUFFER};
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, arena.ebo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, std::max<size_t>(n_indices, 1)*sizeof(unsigned int),
+			NULL, GL_STATIC_DRAW);
+	}
+
+	// glCopyBufferSubData cannot copy between overlapping ranges of one
+	// buffer, those go through scratch.
+	void move(unsigned int buffer, size_t unit, uint32_t from, uint32_t to, uint32_t n){
+		size_t src = from*unit, dst = to*unit, size = n*unit;
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		if(dst + size <= src){
+			glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, src, dst, size);
+			return;
+		}
+
+		if(scratch_size < size){
+			scratch = GLBuffer{GL_COPY_WRITE_BUFFER};
+			glBindBuffer(GL_COPY_WRITE_BUFFER, scratch);
+			glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_COPY);
+			scratch_size = size;
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, scratch);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, src, 0, size);
+		glBindBuffer(GL_COPY_READ_BUFFER, scratch);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, dst, size);
+	}
+};
+
+inline GeometryBlock& GeometryBlock::operator=(GeometryBlock&& other){
+	if(&other != this){
+		if(heap)
+			heap->free(*this);
+		heap = other.heap;
+		arena = other.arena;
+		vertices = other.vertices;
+		indices = other.indices;
+		other.heap = nullptr;
+	}
+	return *this;
+}
+
+inline GeometryBlock::~GeometryBlock(){
+	if(heap)
+		heap->free(*this);
+}
+
+inline unsigned int GeometryBlock::vao() const{
+	return heap->vao(*this);
+}
+
+inline int GeometryBlock::base_vertex() const{
+	return heap->vertex_offset(*this);
+}
+
+inline unsigned int GeometryBlock::first_index() const{
+	return heap->index_offset(*this);
+}
+
+#endif
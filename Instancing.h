@@ -0,0 +1,143 @@
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include <vector>
+#include <chrono>
+#include "GLutils.h"
+#include "ObjMesh.h"
+#include "Culling.h"
+#include "Transforms.h"
+#include "ShaderPermutations.h"
+#include "VertexLayout.h"
+
+// Per instance attributes of PhongInstanced.vert (locations 3 to 9).
+struct InstanceData{
+	vec4 Model[3];        // rows, the fourth is (0, 0, 0, 1)
+	vec4 NormalMatrix[3]; // rows of transpose(inverse(mat3(Model)))
+	vec4 tint;
+};
+static_assert(sizeof(InstanceData) == 112, "7 vec4 attributes");
+
+////////////////////////////////////////////////////////////////////
+// Copies of one mesh, drawn with a single instanced call per material
+// range by GLMesh::draw(const InstanceList&).
+//
+// The copies are culled against the frustum each frame (their bounding
+// spheres in a SphereCuller), and only the visible ones are packed into
+// the instance buffer, which the VAO reads with divisor 1.
+class InstanceList{
+	using Vertex = ObjMesh::Vertex;
+
+	std::vector<InstanceData> instances;
+	std::vector<InstanceData> packed;
+	std::vector<unsigned int> visible;
+	SphereCuller culler;
+	vec3 bbox_min, bbox_max;
+	GLBuffer buffer;
+	VAO vao;
+	unsigned int vao_vertices = 0; // buffers the VAO was set up with
+	unsigned int vao_indices = 0;
+
+	public:
+	// Instanced variants; nullptr draws with the program in use.
+	ShaderPermutations* permutations = nullptr;
+
+	// CPU time of the last cull(): culling and packing, then the call
+	// that hands the instance buffer to the driver.
+	struct Stats{
+		double cull_ms = 0;
+		double upload_ms = 0;
+	}stats;
+
+	// bbox_min and bbox_max: object space box of the mesh.
+	InstanceList(vec3 bbox_min = {0, 0, 0}, vec3 bbox_max = {0, 0, 0})
+		: bbox_min{bbox_min}, bbox_max{bbox_max}
+	{}
+
+	unsigned int add(mat4 Model, vec4 tint = {1, 1, 1, 1}){
+		instances.emplace_back();
+		culler.add({0, 0, 0}, 0);
+		set(instances.size()-1, Model, tint);
+		return instances.size()-1;
+	}
+
+	void set(unsigned int i, mat4 Model, vec4 tint = {1, 1, 1, 1}){
+		InstanceData& d = instances[i];
+		for(int r = 0; r < 3; r++)
+			d.Model[r] = Model[r];
+		normal_matrix(Model, d.NormalMatrix);
+		d.tint = tint;
+
+		vec3 center;
+		float radius;
+		bounding_sphere(Model, bbox_min, bbox_max, center, radius);
+		culler.set(i, center, radius);
+	}
+
+	void clear(){
+		instances.clear();
+		culler.clear();
+		visible.clear();
+	}
+
+	unsigned int size() const{
+		return instances.size();
+	}
+
+	// Instances drawn after the last cull().
+	unsigned int count() const{
+		return visible.size();
+	}
+
+	// Builds the list of visible instances and uploads it.
+	void cull(const Frustum& frustum){
+		using Clock = std::chrono::steady_clock;
+		auto t0 = Clock::now();
+		culler.cull(frustum, visible);
+
+		packed.resize(visible.size());
+		for(unsigned int k = 0; k < visible.size(); k++)
+			packed[k] = instances[visible[k]];
+
+		auto t1 = Clock::now();
+		if(buffer.id == 0)
+			buffer = GLBuffer{GL_ARRAY_BUFFER};
+		// a new store each frame, so the previous draws are not waited for
+		buffer.data(packed, GL_STREAM_DRAW);
+		auto t2 = Clock::now();
+
+		stats.cull_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+		stats.upload_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+	}
+
+	// VAO reading the vertices of the mesh from vertex_buffer (and
+	// index_buffer if not 0) and the instances from the instance buffer.
+	unsigned int vertex_array(unsigned int vertex_buffer, unsigned int index_buffer){
+		if(vao.id != 0 && vao_vertices == vertex_buffer && vao_indices == index_buffer)
+			return vao;
+
+		if(buffer.id == 0)
+			buffer = GLBuffer{GL_ARRAY_BUFFER};
+
+		vao = VAO{true};
+		vao_vertices = vertex_buffer;
+		vao_indices = index_buffer;
+		bind_vertex_array(vao);
+
+		vertex_layout(vertex_buffer);
+
+		bind_buffer(GL_ARRAY_BUFFER, buffer);
+		for(int i = 0; i < 7; i++){
+			glEnableVertexAttribArray(3 + i);
+			glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(i*sizeof(vec4)));
+			glVertexAttribDivisor(3 + i, 1);
+		}
+
+		// the element array binding is part of the VAO
+		if(index_buffer != 0)
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+		return vao;
+	}
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <vector>
+#include <cstddef>
+#include "GLutils.h"
+
+////////////////////////////////////////////////////////////////////
+// position.w = 0 for directional lights.
+struct Light{
+	vec4 position;
+	vec3 Ia;
+	vec3 Id;
+	vec3 Is;
+};
+
+////////////////////////////////////////////////////////////////////
+// Uniform buffer with the lights of the scene, shared by every program
+// that declares
+//
+//   layout(std140) uniform LightBlock{
+//       int n_lights;
+//       Light lights[MAX_LIGHTS];
+//   };
+//
+// Light positions are transformed to view space here, once per frame, 
+// instead of once per fragment and light in the shader.
+struct LightBlock{
+	// an enumerator, so that std::min can take it by reference
+	enum{ max_lights = 16 };
+
+	LightBlock() = default;
+
+	LightBlock(bool init){
+		if(!init)
+			return;
+		ubo = GLBuffer{GL_UNIFORM_BUFFER};
+		bind_buffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(Data), NULL, GL_DYNAMIC_DRAW);
+		bind_buffer_base(GL_UNIFORM_BUFFER, uniform_block_binding("LightBlock"), ubo);
+	}
+
+	// Uploads lights (at most max_lights) with a single glBufferSubData.
+	void update(const std::vector<Light>& lights, mat4 View){
+		int n = std::min((int)lights.size(), max_lights);
+		data.n_lights = n;
+		for(int i = 0; i < n; i++){
+			data.lights[i].position = View*lights[i].position;
+			data.lights[i].Ia = lights[i].Ia;
+			data.lights[i].Id = lights[i].Id;
+			data.lights[i].Is = lights[i].Is;
+		}
+
+		size_t size = offsetof(Data, lights) + n*sizeof(Std140Light);
+		bind_buffer(GL_UNIFORM_BUFFER, ubo);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, size, &data);
+	}
+
+	private:
+	// std140: each vec3 starts at a multiple of 16 bytes
+	struct Std140Light{
+		vec4 position;
+		vec3 Ia; float pad0;
+		vec3 Id; float pad1;
+		vec3 Is; float pad2;
+	};
+	struct Data{
+		int n_lights;
+		int pad[3];
+		Std140Light lights[max_lights];
+	};
+	static_assert(sizeof(Std140Light) == 64, "std140 layout of Light");
+
+	GLBuffer ubo;
+	Data data;
+};
+
+#endif
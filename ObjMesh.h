@@ -29,7 +29,7 @@ struct MaterialRange{
 
 using MeshMaterial = std::map<std::string, MaterialInfo>;
 
-std::istream& operator>>(std::istream& in, MeshMaterial& v){
+inline std::istream& operator>>(std::istream& in, MeshMaterial& v){
 	std::string str;
 	MaterialInfo* info = nullptr;
 	while(in >> str){
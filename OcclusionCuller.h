@@ -0,0 +1,390 @@
+#ifndef OCCLUSION_CULLER_H
+#define OCCLUSION_CULLER_H
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cmath>
+#include <algorithm>
+#include "matrix.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define OCCLUSION_SSE
+#include <xmmintrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////
+// Occlusion culling on the CPU.
+//
+// The triangles of a few large occluders are rasterized into a small
+// depth buffer, in tiles rasterized by worker threads in parallel. The
+// threads are created with the first frame and sleep between frames. Bounding
+// boxes of the other objects are then tested against a pyramid
+// holding, for each texel, the farthest depth of the texels below it.
+//
+// Depth is stored as 1/w (w = distance along the view direction), which
+// is linear in screen space and does not depend on the depth range of
+// Projection: 0 is infinitely far and larger values are nearer.
+//
+// Each frame: add_occluder() for every occluder, begin() to start the
+// rasterization in background, other work, then finish() and visible().
+class OcclusionCuller{
+	public:
+	static const int width = 256;
+	static const int height = 128;
+
+	struct Stats{
+		unsigned int occluder_triangles = 0;
+		unsigned int tested = 0;
+		unsigned int occluded = 0;
+	}stats;
+
+	~OcclusionCuller(){
+		finish();
+		{
+			std::lock_guard<std::mutex> lock{mutex};
+			quit = true;
+		}
+		wake.notify_all();
+		for(std::thread& t: threads)
+			t.join();
+	}
+
+	// triangles (3 vertices each, object space) must stay valid until finish().
+	void add_occluder(const std::vector<vec3>& triangles, mat4 Model){
+		occluders.push_back({&triangles, Model});
+	}
+
+	void begin(mat4 View, mat4 Projection){
+		wait_frame();
+		PV = Projection*View;
+		stats = {};
+
+		if(threads.empty()){
+			int n_threads = std::min<int>(std::max(1u, std::thread::hardware_concurrency()), 8);
+			threads.emplace_back(&OcclusionCuller::run_frames, this);
+			for(int i = 1; i < n_threads; i++)
+				threads.emplace_back(&OcclusionCuller::run_tiles, this);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock{mutex};
+			frames_started++;
+		}
+		wake.notify_all();
+	}
+
+	void finish(){
+		wait_frame();
+		occluders.clear();
+	}
+
+	// False if the box [bbox_min, bbox_max] after Model is completely
+	// behind the occluders.
+	bool visible(mat4 Model, vec3 bbox_min, vec3 bbox_max){
+		stats.tested++;
+		if(pyramid.empty())
+			return true;
+		mat4 M = PV*Model;
+
+		float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+		float nearest = 0;
+		for(int i = 0; i < 8; i++){
+			vec3 p = {
+				(i & 1)? bbox_max.x: bbox_min.x,
+				(i & 2)? bbox_max.y: bbox_min.y,
+				(i & 4)? bbox_max.z: bbox_min.z
+			};
+			vec4 c = M*toVec4(p, 1);
+			if(c.w < min_w)
+				return true; // crosses the camera plane
+			float inv_w = 1/c.w;
+			float sx = (c.x*inv_w*0.5f + 0.5f)*width;
+			float sy = (c.y*inv_w*0.5f + 0.5f)*height;
+			x0 = std::min(x0, sx);
+			y0 = std::min(y0, sy);
+			x1 = std::max(x1, sx);
+			y1 = std::max(y1, sy);
+			nearest = std::max(nearest, inv_w);
+		}
+
+		int ix0 = std::max(0, (int)std::floor(x0));
+		int iy0 = std::max(0, (int)std::floor(y0));
+		int ix1 = std::min(width-1, (int)std::floor(x1));
+		int iy1 = std::min(height-1, (int)std::floor(y1));
+		if(ix0 > ix1 || iy0 > iy1)
+			return true; // off screen, left to frustum culling
+
+		// the level where the rectangle covers at most 2x2 texels
+		int level = 0;
+		while(level+1 < (int)pyramid.size() && ((ix1 >> level) - (ix0 >> level) > 1 || (iy1 >> level) - (iy0 >> level) > 1))
+			level++;
+
+		const Level& L = pyramid[level];
+		for(int y = iy0 >> level; y <= iy1 >> level; y++)
+			for(int x = ix0 >> level; x <= ix1 >> level; x++)
+				if(nearest >= L.depth[y*L.width + x])
+					return true;
+
+		stats.occluded++;
+		return false;
+	}
+
+	private:
+	static const int tile_width = 32;
+	static const int tile_height = 32;
+	static const int tiles_x = width/tile_width;
+	static const int tiles_y = height/tile_height;
+	static constexpr float min_w = 1e-3f;
+
+	struct Occluder{
+		const std::vector<vec3>* triangles;
+		mat4 Model;
+	};
+
+	// screen space triangle
+	struct Triangle{
+		float x[3], y[3], inv_w[3];
+	};
+
+	struct Level{
+		int width, height;
+		std::vector<float> depth;
+	};
+
+	std::vector<Occluder> occluders;
+	mat4 PV;
+
+	// threads[0] runs setup, rasterization and pyramid of each frame, the
+	// others only help with the tiles
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	unsigned long frames_started = 0;
+	unsigned long frames_done = 0;
+	unsigned long tile_pass = 0;
+	int helpers_done = 0;
+	bool quit = false;
+	std::atomic<int> next_tile{0};
+	std::vector<Triangle> triangles;
+	std::vector<std::vector<unsigned int>> bins{tiles_x*tiles_y};
+	std::vector<Level> pyramid;
+
+	// Transforms, clips against w = min_w and bins the triangles into tiles.
+	void setup(){
+		triangles.clear();
+		for(auto& bin: bins)
+			bin.clear();
+
+		for(const Occluder& o: occluders){
+			mat4 M = PV*o.Model;
+			const std::vector<vec3>& T = *o.triangles;
+			for(size_t i = 0; i+2 < T.size(); i += 3){
+				vec4 c[3] = {M*toVec4(T[i], 1), M*toVec4(T[i+1], 1), M*toVec4(T[i+2], 1)};
+
+				// clipped polygon has at most 4 vertices
+				vec4 poly[4];
+				int n = 0;
+				for(int k = 0; k < 3; k++){
+					vec4 a = c[k], b = c[(k+1)%3];
+					if(a.w >= min_w)
+						poly[n++] = a;
+					if((a.w >= min_w) != (b.w >= min_w)){
+						float t = (min_w - a.w)/(b.w - a.w);
+						poly[n++] = a + t*(b - a);
+					}
+				}
+				for(int k = 1; k+1 < n; k++)
+					add_triangle(poly[0], poly[k], poly[k+1]);
+			}
+		}
+		stats.occluder_triangles = triangles.size();
+	}
+
+	void add_triangle(vec4 a, vec4 b, vec4 c){
+		Triangle t;
+		vec4 v[3] = {a, b, c};
+		float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+		for(int k = 0; k < 3; k++){
+			t.inv_w[k] = 1/v[k].w;
+			t.x[k] = (v[k].x*t.inv_w[k]*0.5f + 0.5f)*width;
+			t.y[k] = (v[k].y*t.inv_w[k]*0.5f + 0.5f)*height;
+			x0 = std::min(x0, t.x[k]);
+			y0 = std::min(y0, t.y[k]);
+			x1 = std::max(x1, t.x[k]);
+			y1 = std::max(y1, t.y[k]);
+		}
+		if(x1 < 0 || y1 < 0 || x0 >= width || y0 >= height)
+			return;
+
+		int tx0 = std::max(0, (int)x0/tile_width);
+		int ty0 = std::max(0, (int)y0/tile_height);
+		int tx1 = std::min(tiles_x-1, (int)x1/tile_width);
+		int ty1 = std::min(tiles_y-1, (int)y1/tile_height);
+
+		unsigned int index = triangles.size();
+		triangles.push_back(t);
+		for(int ty = ty0; ty <= ty1; ty++)
+			for(int tx = tx0; tx <= tx1; tx++)
+				bins[ty*tiles_x + tx].push_back(index);
+	}
+
+	void rasterize(){
+		if(pyramid.empty()){
+			for(int w = width, h = height; ; w = std::max(1, w/2), h = std::max(1, h/2)){
+				pyramid.push_back({w, h, std::vector<float>(w*h)});
+				if(w == 1 && h == 1)
+					break;
+			}
+		}
+		std::fill(pyramid[0].depth.begin(), pyramid[0].depth.end(), 0.0f);
+
+		next_tile = 0;
+		{
+			std::lock_guard<std::mutex> lock{mutex};
+			helpers_done = 0;
+			tile_pass++;
+		}
+		wake.notify_all();
+		rasterize_tiles();
+
+		std::unique_lock<std::mutex> lock{mutex};
+		done.wait(lock, [this]{ return helpers_done == (int)threads.size()-1; });
+	}
+
+	// each tile is written by a single thread
+	void rasterize_tiles(){
+		for(int tile = next_tile++; tile < tiles_x*tiles_y; tile = next_tile++)
+			for(unsigned int t: bins[tile])
+				rasterize_triangle(triangles[t], tile % tiles_x * tile_width, tile / tiles_x * tile_height);
+	}
+
+	void run_frames(){
+		for(;;){
+			{
+				std::unique_lock<std::mutex> lock{mutex};
+				wake.wait(lock, [this]{ return quit || frames_done != frames_started; });
+				if(quit)
+					return;
+			}
+			setup();
+			rasterize();
+			build_pyramid();
+			{
+				std::lock_guard<std::mutex> lock{mutex};
+				frames_done = frames_started;
+			}
+			done.notify_all();
+		}
+	}
+
+	void run_tiles(){
+		unsigned long pass = 0;
+		for(;;){
+			{
+				std::unique_lock<std::mutex> lock{mutex};
+				wake.wait(lock, [&]{ return quit || tile_pass != pass; });
+				if(quit)
+					return;
+				pass = tile_pass;
+			}
+			rasterize_tiles();
+			{
+				std::lock_guard<std::mutex> lock{mutex};
+				helpers_done++;
+			}
+			done.notify_all();
+		}
+	}
+
+	void wait_frame(){
+		std::unique_lock<std::mutex> lock{mutex};
+		done.wait(lock, [this]{ return frames_done == frames_started; });
+	}
+
+	// Pixel centers inside the triangle get the nearest of both depths.
+	void rasterize_triangle(const Triangle& t, int tile_x, int tile_y){
+		float area = (t.x[1]-t.x[0])*(t.y[2]-t.y[0]) - (t.x[2]-t.x[0])*(t.y[1]-t.y[0]);
+		if(std::fabs(area) < 1e-8f)
+			return;
+
+		// edge k goes from vertex k+1 to vertex k+2 and is positive inside
+		float s = area > 0? 1: -1;
+		float A[3], B[3], C[3];
+		for(int k = 0; k < 3; k++){
+			int i = (k+1)%3, j = (k+2)%3;
+			A[k] = -s*(t.y[j] - t.y[i]);
+			B[k] = s*(t.x[j] - t.x[i]);
+			C[k] = -(A[k]*t.x[i] + B[k]*t.y[i]);
+		}
+		float inv_area = s/area;
+		float dzdx = (A[0]*t.inv_w[0] + A[1]*t.inv_w[1] + A[2]*t.inv_w[2])*inv_area;
+		float dzdy = (B[0]*t.inv_w[0] + B[1]*t.inv_w[1] + B[2]*t.inv_w[2])*inv_area;
+		float z0 = (C[0]*t.inv_w[0] + C[1]*t.inv_w[1] + C[2]*t.inv_w[2])*inv_area;
+
+		float fx0 = std::min({t.x[0], t.x[1], t.x[2]});
+		float fx1 = std::max({t.x[0], t.x[1], t.x[2]});
+		float fy0 = std::min({t.y[0], t.y[1], t.y[2]});
+		float fy1 = std::max({t.y[0], t.y[1], t.y[2]});
+		int x0 = std::max(tile_x, (int)std::floor(fx0)) & ~3;
+		int x1 = std::min(tile_x + tile_width, (int)std::ceil(fx1));
+		int y0 = std::max(tile_y, (int)std::floor(fy0));
+		int y1 = std::min(tile_y + tile_height, (int)std::ceil(fy1));
+
+		float* depth = pyramid[0].depth.data();
+		for(int y = y0; y < y1; y++){
+			float py = y + 0.5f;
+			float* row = depth + y*width;
+#ifdef OCCLUSION_SSE
+			__m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+			__m128 e_row[3], e_dx[3];
+			for(int k = 0; k < 3; k++){
+				e_row[k] = _mm_set1_ps(B[k]*py + C[k]);
+				e_dx[k] = _mm_set1_ps(A[k]);
+			}
+			__m128 z_row = _mm_set1_ps(dzdy*py + z0);
+			__m128 z_dx = _mm_set1_ps(dzdx);
+			for(int x = x0; x < x1; x += 4){
+				__m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+				__m128 zero = _mm_setzero_ps();
+				__m128 mask = _mm_cmpge_ps(_mm_add_ps(e_row[0], _mm_mul_ps(e_dx[0], px)), zero);
+				mask = _mm_and_ps(mask, _mm_cmpge_ps(_mm_add_ps(e_row[1], _mm_mul_ps(e_dx[1], px)), zero));
+				mask = _mm_and_ps(mask, _mm_cmpge_ps(_mm_add_ps(e_row[2], _mm_mul_ps(e_dx[2], px)), zero));
+				if(_mm_movemask_ps(mask) == 0)
+					continue;
+				__m128 z = _mm_add_ps(z_row, _mm_mul_ps(z_dx, px));
+				__m128 old = _mm_loadu_ps(row + x);
+				__m128 nearest = _mm_max_ps(old, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(mask, nearest), _mm_andnot_ps(mask, old)));
+			}
+#else
+			for(int x = x0; x < x1; x++){
+				float px = x + 0.5f;
+				if(A[0]*px + B[0]*py + C[0] >= 0 && A[1]*px + B[1]*py + C[1] >= 0 && A[2]*px + B[2]*py + C[2] >= 0)
+					row[x] = std::max(row[x], dzdx*px + dzdy*py + z0);
+			}
+#endif
+		}
+	}
+
+	// Each texel keeps the farthest (smallest 1/w) of the texels below it.
+	void build_pyramid(){
+		for(size_t l = 1; l < pyramid.size(); l++){
+			const Level& src = pyramid[l-1];
+			Level& dst = pyramid[l];
+			for(int y = 0; y < dst.height; y++)
+				for(int x = 0; x < dst.width; x++){
+					int sx = std::min(2*x+1, src.width-1), sy = std::min(2*y+1, src.height-1);
+					dst.depth[y*dst.width + x] = std::min({
+						src.depth[2*y*src.width + 2*x], src.depth[2*y*src.width + sx],
+						src.depth[sy*src.width + 2*x], src.depth[sy*src.width + sx]
+					});
+				}
+		}
+	}
+};
+
+#endif
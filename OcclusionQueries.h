@@ -0,0 +1,153 @@
+#ifndef OCCLUSION_QUERIES_H
+#define OCCLUSION_QUERIES_H
+
+#include <cmath>
+#include "GLutils.h"
+#include "Transforms.h"
+
+////////////////////////////////////////////////////////////////////
+// Occlusion queries for meshes that are expensive to draw.
+//
+// The bounding box of the mesh is drawn first, with color and depth
+// writes off, inside a GL_ANY_SAMPLES_PASSED query. The mesh is then
+// drawn inside glBeginConditionalRender with GL_QUERY_NO_WAIT: the GPU
+// skips it if the result is ready and no sample of the box passed the
+// depth test, and draws it otherwise. The CPU never waits for a result.
+//
+// Only what was drawn before can hide a mesh, so draw occluders first.
+class OcclusionQueries{
+	ShaderProgram program;
+	VAO vao;
+	GLBuffer vbo;
+
+	public:
+	struct Stats{
+		int issued = 0;
+		int skipped = 0; // results without samples, read a frame later
+	};
+	Stats frame_stats;  // this frame so far
+	Stats last_frame;
+
+	void new_frame(){
+		last_frame = frame_stats;
+		frame_stats = {};
+	}
+
+	// test() followed by begin(query).
+	bool begin(const GLQuery& query, bool& pending, const TransformSlot& slot, 
+			vec3 bbox_min, vec3 bbox_max){
+		if(!test(query, pending, slot, bbox_min, bbox_max))
+			return false;
+		begin(query);
+		return true;
+	}
+
+	// Draws the box of the object in slot inside query. Returns false 
+	// without issuing anything when the box crosses the near or far plane,
+	// since clipping could then hide a visible object; draw it 
+	// unconditionally. pending tells whether query holds a result not yet
+	// counted.
+	bool test(const GLQuery& query, bool& pending, const TransformSlot& slot, 
+			vec3 bbox_min, vec3 bbox_max){
+		if(pending){
+			GLuint available = 0;
+			glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if(available){
+				GLuint samples = 1;
+				glGetQueryObjectuiv(query, GL_QUERY_RESULT, &samples);
+				if(samples == 0)
+					frame_stats.skipped++;
+			}
+			pending = false;
+		}
+
+		const ObjectStd140* m = slot.matrices();
+		if(m == nullptr || crosses_depth_range(m->MVP, bbox_min, bbox_max))
+			return false;
+
+		if(program.id == 0)
+			init();
+
+		unsigned int previous = currentProgram();
+		bool depth_write = gl_state.depth_mask;
+		unsigned int colors = gl_state.color_mask;
+		bool cull = gl_state.enabled[GLState::capability_index(GL_CULL_FACE)];
+
+		use_program(program);
+		Uniform{"bbox_min"} = bbox_min;
+		Uniform{"bbox_max"} = bbox_max;
+		slot.bind();
+		depth_mask(false);
+		color_mask(false, false, false, false);
+		disable(GL_CULL_FACE);
+
+		bind_vertex_array(vao);
+		glBeginQuery(GL_ANY_SAMPLES_PASSED, query);
+		glDrawArrays(GL_TRIANGLES, 0, 36);
+		glEndQuery(GL_ANY_SAMPLES_PASSED);
+
+		set_enabled(GL_CULL_FACE, cull);
+		color_mask(colors & 1, colors & 2, colors & 4, colors & 8);
+		depth_mask(depth_write);
+		use_program(previous);
+
+		frame_stats.issued++;
+		pending = true;
+		return true;
+	}
+
+	// What is drawn until end() is skipped if the last test of query
+	// found no samples. May be repeated for the same test.
+	void begin(const GLQuery& query){
+		glBeginConditionalRender(query, GL_QUERY_NO_WAIT);
+	}
+
+	void end(){
+		glEndConditionalRender();
+	}
+
+	private:
+	static bool crosses_depth_range(mat4 MVP, vec3 bbox_min, vec3 bbox_max){
+		for(int i = 0; i < 8; i++){
+			vec3 p = {
+				(i & 1)? bbox_max.x: bbox_min.x,
+				(i & 2)? bbox_max.y: bbox_min.y,
+				(i & 4)? bbox_max.z: bbox_min.z
+			};
+			vec4 c = MVP*toVec4(p, 1);
+			if(c.w <= 0 || std::fabs(c.z) >= c.w)
+				return true;
+		}
+		return false;
+	}
+
+	void init(){
+		program = ShaderProgram{
+			Shader{"BoundingBox.vert", GL_VERTEX_SHADER},
+			Shader{"BoundingBox.frag", GL_FRAGMENT_SHADER}
+		};
+
+		std::vector<vec3> V;
+		vec3 P[8];
+		for(int i = 0; i < 8; i++)
+			P[i] = {i&1? 1.0f: 0.0f, i&2? 1.0f: 0.0f, i&4? 1.0f: 0.0f};
+
+		int faces[6][4] = {
+			{1, 5, 7, 3}, {4, 0, 2, 6}, {2, 3, 7, 6},
+			{4, 5, 1, 0}, {5, 4, 6, 7}, {0, 1, 3, 2}
+		};
+		for(auto f: faces)
+			V.insert(V.end(), {P[f[0]], P[f[1]], P[f[2]], P[f[0]], P[f[2]], P[f[3]]});
+
+		vao = VAO{true};
+		bind_vertex_array(vao);
+
+		vbo = GLBuffer{GL_ARRAY_BUFFER};
+		vbo.data(V, GL_STATIC_DRAW);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	}
+};
+
+#endif
@@ -0,0 +1,344 @@
+#ifndef OFFSET_ALLOCATOR_H
+#define OFFSET_ALLOCATOR_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+////////////////////////////////////////////////////////////////////
+// Allocates ranges of [0, size) with the two level segregated fit
+// scheme (TLSF): free blocks are kept in lists by size class, the
+// power of two of the size and 3 more bits of it, and two levels of
+// bitmaps find a non empty list large enough in constant time. Freed
+// blocks are merged with free neighbours at once. Nothing is stored in
+// the managed range itself, so it can describe GPU memory.
+//
+// Units are whatever the caller counts in (vertices, indices, bytes).
+class OffsetAllocator{
+	static const int sl_bits = 3;
+	static const int sl_count = 1 << sl_bits;
+	static const int fl_count = 32;
+
+	struct Block{
+		uint32_t offset;
+		uint32_t size;
+		uint32_t prev_phys = none;   // neighbours in the range
+		uint32_t next_phys = none;
+		uint32_t prev_free = none;   // neighbours in the list of its class
+		uint32_t next_free = none;
+		bool free = false;
+	};
+
+	std::vector<Block> blocks;
+	std::vector<uint32_t> unused; // recycled entries of blocks
+	uint32_t first = none;        // the block at offset 0
+	uint32_t fl_bitmap = 0;
+	uint32_t sl_bitmap[fl_count] = {};
+	uint32_t heads[fl_count][sl_count];
+	uint32_t size;
+	uint32_t used = 0;
+	uint32_t allocations = 0;
+
+	public:
+	// an enumerator, so that it can be bound to references without a
+	// definition outside the class
+	enum : uint32_t{ none = ~0u };
+
+	struct Allocation{
+		uint32_t offset = none;
+		uint32_t block = none;
+
+		explicit operator bool() const{ return block != none; }
+	};
+
+	struct Report{
+		uint32_t size = 0;
+		uint32_t used = 0;
+		uint32_t allocations = 0;
+		uint32_t free_blocks = 0;
+		uint32_t largest_free = 0;
+
+		// 0 when the free space is one block, near 1 when it is scattered
+		float fragmentation() const{
+			uint32_t free = size - used;
+			return free > 0? 1 - largest_free/(float)free: 0;
+		}
+	};
+
+	OffsetAllocator(uint32_t size = 0) : size{size}{
+		reset();
+	}
+
+	uint32_t capacity() const{
+		return size;
+	}
+
+	// Frees everything.
+	void reset(){
+		blocks.clear();
+		unused.clear();
+		fl_bitmap = 0;
+		std::fill(sl_bitmap, sl_bitmap + fl_count, 0);
+		for(auto& list: heads)
+			std::fill(list, list + sl_count, none);
+		used = 0;
+		allocations = 0;
+		first = none;
+		if(size > 0){
+			first = new_block(0, size);
+			insert_free(first);
+		}
+	}
+
+	Allocation allocate(uint32_t n){
+		if(n == 0)
+			return {};
+
+		// round up to the next class boundary, so that any block of the
+		// class found is large enough
+		uint64_t rounded = n;
+		if(n >= (uint32_t)sl_count)
+			rounded += (1u << (log2(n) - sl_bits)) - 1;
+		if(rounded > 0xffffffffu)
+			return {};
+
+		int fl, sl;
+		mapping((uint32_t)rounded, fl, sl);
+		uint32_t b = find_free(fl, sl);
+		if(b == none)
+			b = find_fit(n);
+		if(b == none)
+			return {};
+
+		remove_free(b);
+		if(blocks[b].size > n){
+			uint32_t rest = new_block(blocks[b].offset + n, blocks[b].size - n);
+			blocks[b].size = n;
+			link_after(b, rest);
+			insert_free(rest);
+		}
+		used += n;
+		allocations++;
+		return {blocks[b].offset, b};
+	}
+
+	void free(Allocation a){
+		if(!a)
+			return;
+		uint32_t b = a.block;
+		used -= blocks[b].size;
+		allocations--;
+
+		uint32_t prev = blocks[b].prev_phys;
+		if(prev != none && blocks[prev].free){
+			remove_free(prev);
+			blocks[prev].size += blocks[b].size;
+			unlink(b);
+			b = prev;
+		}
+		uint32_t next = blocks[b].next_phys;
+		if(next != none && blocks[next].free){
+			remove_free(next);
+			blocks[b].size += blocks[next].size;
+			unlink(next);
+		}
+		insert_free(b);
+	}
+
+	// Offset of an allocation, which compact() may change.
+	uint32_t offset(Allocation a) const{
+		return blocks[a.block].offset;
+	}
+
+	uint32_t size_of(Allocation a) const{
+		return blocks[a.block].size;
+	}
+
+	// Defragmentation hook: slides every allocation towards offset 0,
+	// in order, calling move(from, to, size) for those that change place
+	// (to < from, the ranges may overlap), and leaves one free block at
+	// the end. Allocations keep their handles; read offsets again.
+	template<class F>
+	void compact(F move){
+		uint32_t cursor = 0;
+		uint32_t last = none;
+		uint32_t b = first;
+		first = none;
+		while(b != none){
+			uint32_t next = blocks[b].next_phys;
+			if(blocks[b].free){
+				remove_free(b);
+				release(b);
+			}else{
+				if(blocks[b].offset != cursor)
+					move(blocks[b].offset, cursor, blocks[b].size);
+				blocks[b].offset = cursor;
+				cursor += blocks[b].size;
+				blocks[b].prev_phys = last;
+				if(last != none)
+					blocks[last].next_phys = b;
+				else
+					first = b;
+				last = b;
+			}
+			b = next;
+		}
+		if(last != none)
+			blocks[last].next_phys = none;
+
+		if(cursor < size){
+			uint32_t rest = new_block(cursor, size - cursor);
+			if(last != none)
+				link_after(last, rest);
+			else
+				first = rest;
+			insert_free(rest);
+		}
+	}
+
+	Report report() const{
+		Report r;
+		r.size = size;
+		r.used = used;
+		r.allocations = allocations;
+		for(int fl = 0; fl < fl_count; fl++)
+			for(int sl = 0; sl < sl_count; sl++)
+				for(uint32_t b = heads[fl][sl]; b != none; b = blocks[b].next_free){
+					r.free_blocks++;
+					r.largest_free = std::max(r.largest_free, blocks[b].size);
+				}
+		return r;
+	}
+
+	private:
+	static int log2(uint32_t x){
+#if defined(__GNUC__)
+		return 31 - __builtin_clz(x);
+#else
+		int l = 0;
+		while(x >>= 1)
+			l++;
+		return l;
+#endif
+	}
+
+	static int lowest_bit(uint32_t x){
+#if defined(__GNUC__)
+		return __builtin_ctz(x);
+#else
+		int i = 0;
+		while(!(x & 1)){
+			x >>= 1;
+			i++;
+		}
+		return i;
+#endif
+	}
+
+	// Sizes below sl_count have a class each (first level 0); above, the
+	// first level is the power of two and the second the next 3 bits.
+	static void mapping(uint32_t n, int& fl, int& sl){
+		if(n < (uint32_t)sl_count){
+			fl = 0;
+			sl = n;
+		}else{
+			int l = log2(n);
+			fl = l - sl_bits + 1;
+			sl = (n >> (l - sl_bits)) - sl_count;
+		}
+	}
+
+	uint32_t find_free(int fl, int sl) const{
+		uint32_t sl_map = sl_bitmap[fl] & (~0u << sl);
+		if(sl_map == 0){
+			uint32_t fl_map = fl + 1 < fl_count? fl_bitmap & (~0u << (fl + 1)): 0;
+			if(fl_map == 0)
+				return none;
+			fl = lowest_bit(fl_map);
+			sl_map = sl_bitmap[fl];
+		}
+		return heads[fl][lowest_bit(sl_map)];
+	}
+
+	// Last resort when no class above n has a block: the blocks of n's
+	// own class may still be large enough (a range of exactly n, say).
+	uint32_t find_fit(uint32_t n) const{
+		int fl, sl;
+		mapping(n, fl, sl);
+		for(uint32_t b = heads[fl][sl]; b != none; b = blocks[b].next_free)
+			if(blocks[b].size >= n)
+				return b;
+		return none;
+	}
+
+	uint32_t new_block(uint32_t offset, uint32_t n){
+		uint32_t b;
+		if(!unused.empty()){
+			b = unused.back();
+			unused.pop_back();
+		}else{
+			b = blocks.size();
+			blocks.emplace_back();
+		}
+		blocks[b] = Block{};
+		blocks[b].offset = offset;
+		blocks[b].size = n;
+		return b;
+	}
+
+	void release(uint32_t b){
+		blocks[b] = Block{};
+		blocks[b].size = 0;
+		unused.push_back(b);
+	}
+
+	void link_after(uint32_t b, uint32_t n){
+		blocks[n].prev_phys = b;
+		blocks[n].next_phys = blocks[b].next_phys;
+		if(blocks[b].next_phys != none)
+			blocks[blocks[b].next_phys].prev_phys = n;
+		blocks[b].next_phys = n;
+	}
+
+	void unlink(uint32_t b){
+		uint32_t prev = blocks[b].prev_phys, next = blocks[b].next_phys;
+		if(prev != none)
+			blocks[prev].next_phys = next;
+		if(next != none)
+			blocks[next].prev_phys = prev;
+		release(b);
+	}
+
+	void insert_free(uint32_t b){
+		int fl, sl;
+		mapping(blocks[b].size, fl, sl);
+		blocks[b].free = true;
+		blocks[b].prev_free = none;
+		blocks[b].next_free = heads[fl][sl];
+		if(heads[fl][sl] != none)
+			blocks[heads[fl][sl]].prev_free = b;
+		heads[fl][sl] = b;
+		fl_bitmap |= 1u << fl;
+		sl_bitmap[fl] |= 1u << sl;
+	}
+
+	void remove_free(uint32_t b){
+		int fl, sl;
+		mapping(blocks[b].size, fl, sl);
+		uint32_t prev = blocks[b].prev_free, next = blocks[b].next_free;
+		if(prev != none)
+			blocks[prev].next_free = next;
+		else
+			heads[fl][sl] = next;
+		if(next != none)
+			blocks[next].prev_free = prev;
+		if(heads[fl][sl] == none){
+			sl_bitmap[fl] &= ~(1u << sl);
+			if(sl_bitmap[fl] == 0)
+				fl_bitmap &= ~(1u << fl);
+		}
+		blocks[b].free = false;
+	}
+};
+
+#endif
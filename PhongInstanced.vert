@@ -0,0 +1,39 @@
+#version 330
+
+// Versão de PhongShaderTex.vert para desenho instanciado (InstanceList em
+// Instancing.h): a Model e a matriz normal de cada cópia chegam como
+// atributos por instância. View deve ser rígida (ou uma reflexão), para
+// que mat3(View) transforme normais.
+uniform mat4 View;
+uniform mat4 Projection;
+
+layout(location=0) in vec4 Position;
+layout(location=1) in vec2 TexCoords;
+layout(location=2) in vec3 Normal;
+
+// linhas de Model (a última é 0 0 0 1) e da matriz normal
+layout(location=3) in vec4 Model0;
+layout(location=4) in vec4 Model1;
+layout(location=5) in vec4 Model2;
+layout(location=6) in vec3 Normal0;
+layout(location=7) in vec3 Normal1;
+layout(location=8) in vec3 Normal2;
+layout(location=9) in vec4 Tint;
+
+out vec3 position;
+out vec3 normal;
+out vec2 texCoords;
+flat out vec4 tint;
+
+void main(){
+	vec4 world = vec4(dot(Model0, Position), dot(Model1, Position), dot(Model2, Position), 1);
+	vec3 n = vec3(dot(Normal0, Normal), dot(Normal1, Normal), dot(Normal2, Normal));
+
+	vec4 eye = View*world;
+	gl_Position = Projection*eye;
+
+	position = vec3(eye);
+	normal = normalize(mat3(View)*n);
+	texCoords = TexCoords;
+	tint = Tint;
+}
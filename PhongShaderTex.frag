@@ -1,18 +1,17 @@
 #version 330
 
-uniform bool has_map_Ka;
+// bit 0: map_Ka, bit 1: map_Kd, bit 2: map_Ks
+uniform int has_map;
 uniform sampler2D map_Ka;
-
-uniform bool has_map_Kd;
 uniform sampler2D map_Kd;
-
-uniform bool has_map_Ks;
 uniform sampler2D map_Ks;
 
-uniform vec3 Ka;
-uniform vec3 Kd;
-uniform vec3 Ks;
-uniform float shininess;
+layout(std140) uniform MaterialBlock{
+	vec3 Ka;
+	vec3 Kd;
+	vec3 Ks;
+	float shininess;
+};
 
 uniform vec4 light_position;
 uniform vec3 Ia;
@@ -24,6 +23,10 @@ uniform mat4 View;
 in vec3 position;
 in vec3 normal;
 in vec2 texCoords;
+#ifdef INSTANCED
+// cor de cada cópia (PhongInstanced.vert)
+flat in vec4 tint;
+#endif
 
 out vec4 FragColor;
 
@@ -34,22 +37,26 @@ void main(){
 
 	float alpha = 1;
 
-	if(has_map_Ka){
+	if((has_map & 1) != 0){
 		vec4 col = texture(map_Ka, texCoords);
 		ka = ka*col.rgb;
 	}
-	if(has_map_Kd){
+	if((has_map & 2) != 0){
 		vec4 col = texture(map_Kd, texCoords);
 		kd = kd*col.rgb;
 		ka = ka*col.rgb;
 		alpha = col.a;
 	}
-	if(has_map_Ks){
+	if((has_map & 4) != 0){
 		vec4 col = texture(map_Ks, texCoords);
 		ks = ks*col.rgb;
 	}
 	if(alpha < 0.1)
 		discard;
+#ifdef INSTANCED
+	ka = ka*tint.rgb;
+	kd = kd*tint.rgb;
+#endif
 
 	// direção do observador
 	vec3 wr = normalize(-position); 
@@ -1,8 +1,11 @@
 #version 330
 
-uniform mat4 Projection; 
-uniform mat4 Model; 
-uniform mat4 View; 
+// Calculadas uma vez por objeto na CPU (Transforms.h)
+layout(std140, row_major) uniform ObjectBlock{
+	mat4 ModelView;
+	mat4 MVP;
+	mat3 NormalMatrix;
+};
 
 layout(location=0) in vec4 Position;
 layout(location=1) in vec2 TexCoords;
@@ -13,12 +16,9 @@ out vec3 normal;
 out vec2 texCoords;
 
 void main(){
-	gl_Position = Projection*View*Model*Position;
+	gl_Position = MVP*Position;
 
-	mat4 M = View*Model;
-	mat3 NormalMatrix = transpose(inverse(mat3(M)));
-
-	position = vec3(M*Position);
+	position = vec3(ModelView*Position);
 	normal = normalize(NormalMatrix*Normal);
 	texCoords = TexCoords;
 } 
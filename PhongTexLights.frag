@@ -1,34 +1,58 @@
 #version 330
 
-uniform bool has_map_Ka;
+// bit 0: map_Ka, bit 1: map_Kd, bit 2: map_Ks
+uniform int has_map;
 uniform sampler2D map_Ka;
-
-uniform bool has_map_Kd;
 uniform sampler2D map_Kd;
-
-uniform bool has_map_Ks;
 uniform sampler2D map_Ks;
 
-uniform vec3 Ka;
-uniform vec3 Kd;
-uniform vec3 Ks;
-uniform float shininess;
+#ifdef PER_DRAW_MATERIAL
+// Material de cada desenho de um glMultiDrawElementsIndirect (StaticWorld.h)
+flat in vec3 Ka;
+flat in vec3 Kd;
+flat in vec3 Ks;
+flat in float shininess;
+#else
+layout(std140) uniform MaterialBlock{
+	vec3 Ka;
+	vec3 Kd;
+	vec3 Ks;
+	float shininess;
+};
+#endif
 
 #define MAX_LIGHTS 16
 
-uniform struct Light{
-	vec4 position;
+// Variantes (ShaderPermutations.h) definem MAP_KA, MAP_KD e MAP_KS como 
+// true ou false, ALPHA_TEST como 0 ou 1 e LIGHTS com o número máximo de
+// luzes. Sem elas, os mapas e as luzes são escolhidos em tempo de execução.
+#ifndef PERMUTATION
+#define MAP_KA ((has_map & 1) != 0)
+#define MAP_KD ((has_map & 2) != 0)
+#define MAP_KS ((has_map & 4) != 0)
+#define ALPHA_TEST 1
+#define LIGHTS MAX_LIGHTS
+#endif
+
+struct Light{
+	vec4 position; // no referencial do observador
 	vec3 Ia;
 	vec3 Id;
 	vec3 Is;
-}lights[MAX_LIGHTS];
-uniform int n_lights;
-	
-uniform mat4 View;
+};
+
+layout(std140) uniform LightBlock{
+	int n_lights;
+	Light lights[MAX_LIGHTS];
+};
 
 in vec3 position;
 in vec3 normal;
 in vec2 texCoords;
+#ifdef INSTANCED
+// cor de cada cópia (PhongInstanced.vert)
+flat in vec4 tint;
+#endif
 
 out vec4 FragColor;
 
@@ -39,22 +63,28 @@ void main(){
 
 	float alpha = 1;
 
-	if(has_map_Ka){
+	if(MAP_KA){
 		vec4 col = texture(map_Ka, texCoords);
 		ka = ka*col.rgb;
 	}
-	if(has_map_Kd){
+	if(MAP_KD){
 		vec4 col = texture(map_Kd, texCoords);
 		kd = kd*col.rgb;
 		ka = ka*col.rgb;
 		alpha = col.a;
 	}
-	if(has_map_Ks){
+	if(MAP_KS){
 		vec4 col = texture(map_Ks, texCoords);
 		ks = ks*col.rgb;
 	}
+#if ALPHA_TEST
 	if(alpha < 0.1)
 		discard;
+#endif
+#ifdef INSTANCED
+	ka = ka*tint.rgb;
+	kd = kd*tint.rgb;
+#endif
 	
 	// direção do observador
 	vec3 wr = normalize(-position); 
@@ -66,9 +96,12 @@ void main(){
 		N = -N;
 
 	FragColor = vec4(0, 0, 0, alpha);
-	for(int i = 0; i < n_lights; i++){
-		// Posição da luz no referencial do observador
-		vec4 lightPos = View*lights[i].position;
+	// limite constante: o compilador pode desenrolar o laço
+	for(int i = 0; i < LIGHTS; i++){
+		if(i >= n_lights)
+			break;
+
+		vec4 lightPos = lights[i].position;
 
 		// Direção da luz
 		vec3 wi = (lightPos.w == 0)?
@@ -0,0 +1,91 @@
+#version 330
+
+// camada de cada mapa no array de texturas (-1 se o material não tem o mapa)
+uniform int layer_Ka;
+uniform sampler2DArray map_Ka;
+
+uniform int layer_Kd;
+uniform sampler2DArray map_Kd;
+
+uniform int layer_Ks;
+uniform sampler2DArray map_Ks;
+
+layout(std140) uniform MaterialBlock{
+	vec3 Ka;
+	vec3 Kd;
+	vec3 Ks;
+	float shininess;
+};
+
+#define MAX_LIGHTS 16
+
+struct Light{
+	vec4 position; // no referencial do observador
+	vec3 Ia;
+	vec3 Id;
+	vec3 Is;
+};
+
+layout(std140) uniform LightBlock{
+	int n_lights;
+	Light lights[MAX_LIGHTS];
+};
+
+in vec3 position;
+in vec3 normal;
+in vec2 texCoords;
+
+out vec4 FragColor;
+
+void main(){     
+	vec3 ka = Ka;
+	vec3 kd = Kd;
+	vec3 ks = Ks;
+
+	float alpha = 1;
+
+	if(layer_Ka >= 0){
+		vec4 col = texture(map_Ka, vec3(texCoords, layer_Ka));
+		ka = ka*col.rgb;
+	}
+	if(layer_Kd >= 0){
+		vec4 col = texture(map_Kd, vec3(texCoords, layer_Kd));
+		kd = kd*col.rgb;
+		ka = ka*col.rgb;
+		alpha = col.a;
+	}
+	if(layer_Ks >= 0){
+		vec4 col = texture(map_Ks, vec3(texCoords, layer_Ks));
+		ks = ks*col.rgb;
+	}
+	if(alpha < 0.1)
+		discard;
+	
+	// direção do observador
+	vec3 wr = normalize(-position); 
+
+	vec3 N = normalize(normal);
+	
+	// troca a direção da normal caso seja uma backface
+	if(!gl_FrontFacing)
+		N = -N;
+
+	FragColor = vec4(0, 0, 0, alpha);
+	for(int i = 0; i < n_lights; i++){
+		vec4 lightPos = lights[i].position;
+
+		// Direção da luz
+		vec3 wi = (lightPos.w == 0)?
+			normalize(lightPos.xyz): // luz direcional
+			normalize(lightPos.xyz - position); // luz pontual
+
+		// direção do raio refletido
+		vec3 vs = normalize(reflect(-wi, N)); 
+
+		vec3 ambient = ka*lights[i].Ia;
+		vec3 diffuse = kd*lights[i].Id*max(0, dot(wi, N));
+		vec3 specular = ks*lights[i].Is*pow(max(0,dot(vs, wr)), shininess);
+
+		FragColor.rgb += ambient + diffuse + specular;
+	}
+}
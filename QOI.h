@@ -0,0 +1,297 @@
+#ifndef QOI_H
+#define QOI_H
+
+// "Quite OK Image" lossless codec (https://qoiformat.org).
+// Decodes several times faster than PNG at a comparable file size.
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iterator>
+
+struct QOIDesc{
+	unsigned int width = 0;
+	unsigned int height = 0;
+	unsigned char channels = 0;   // 3 = RGB, 4 = RGBA
+	unsigned char colorspace = 0; // 0 = sRGB with linear alpha, 1 = all linear
+};
+
+namespace qoi_detail{
+	enum{
+		OP_INDEX = 0x00,
+		OP_DIFF  = 0x40,
+		OP_LUMA  = 0x80,
+		OP_RUN   = 0xc0,
+		OP_RGB   = 0xfe,
+		OP_RGBA  = 0xff,
+		MASK_2   = 0xc0,
+		HEADER_SIZE = 14,
+		PADDING_SIZE = 8
+	};
+
+	const unsigned char padding[PADDING_SIZE] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+	// Refuse images whose decoded size would not fit comfortably in memory.
+	const unsigned int max_pixels = 400000000;
+
+	union Pixel{
+		struct{ unsigned char r, g, b, a; } rgba;
+		unsigned int v;
+	};
+
+	inline int hash(Pixel p){
+		return (p.rgba.r*3 + p.rgba.g*5 + p.rgba.b*7 + p.rgba.a*11) % 64;
+	}
+
+	inline void write_32(unsigned char* out, int& p, unsigned int v){
+		out[p++] = (v >> 24) & 0xff;
+		out[p++] = (v >> 16) & 0xff;
+		out[p++] = (v >>  8) & 0xff;
+		out[p++] = v & 0xff;
+	}
+
+	inline unsigned int read_32(const unsigned char* in, int& p){
+		unsigned int a = in[p++], b = in[p++], c = in[p++], d = in[p++];
+		return a << 24 | b << 16 | c << 8 | d;
+	}
+}
+
+////////////////////////////////////////////////////////////////////
+// Reads only the header. Returns false if data is not a QOI image.
+inline bool qoi_read_header(const unsigned char* data, size_t size, QOIDesc& desc){
+	using namespace qoi_detail;
+	if(data == nullptr || size < HEADER_SIZE + PADDING_SIZE)
+		return false;
+
+	int p = 0;
+	if(read_32(data, p) != 0x716f6966) // "qoif"
+		return false;
+
+	desc.width = read_32(data, p);
+	desc.height = read_32(data, p);
+	desc.channels = data[p++];
+	desc.colorspace = data[p++];
+
+	return desc.width != 0 && desc.height != 0 &&
+		(desc.channels == 3 || desc.channels == 4) &&
+		desc.colorspace <= 1 &&
+		desc.height < max_pixels/desc.width;
+}
+
+////////////////////////////////////////////////////////////////////
+// Encodes width*height*channels tightly packed bytes.
+inline std::vector<unsigned char> qoi_encode(const unsigned char* pixels, QOIDesc desc){
+	using namespace qoi_detail;
+	std::vector<unsigned char> res;
+	if(pixels == nullptr || desc.width == 0 || desc.height == 0 ||
+	   (desc.channels != 3 && desc.channels != 4) ||
+	   desc.height >= max_pixels/desc.width)
+		return res;
+
+	size_t n_pixels = (size_t)desc.width*desc.height;
+	res.resize(HEADER_SIZE + n_pixels*(desc.channels+1) + PADDING_SIZE);
+	unsigned char* out = res.data();
+
+	int p = 0;
+	write_32(out, p, 0x716f6966);
+	write_32(out, p, desc.width);
+	write_32(out, p, desc.height);
+	out[p++] = desc.channels;
+	out[p++] = desc.colorspace;
+
+	Pixel index[64];
+	memset(index, 0, sizeof(index));
+
+	Pixel px_prev;
+	px_prev.rgba = {0, 0, 0, 255};
+	Pixel px = px_prev;
+
+	int run = 0;
+	size_t px_end = n_pixels*desc.channels;
+	for(size_t px_pos = 0; px_pos < px_end; px_pos += desc.channels){
+		px.rgba.r = pixels[px_pos];
+		px.rgba.g = pixels[px_pos+1];
+		px.rgba.b = pixels[px_pos+2];
+		if(desc.channels == 4)
+			px.rgba.a = pixels[px_pos+3];
+
+		if(px.v == px_prev.v){
+			run++;
+			if(run == 62 || px_pos + desc.channels == px_end){
+				out[p++] = OP_RUN | (run - 1);
+				run = 0;
+			}
+			continue;
+		}
+
+		if(run > 0){
+			out[p++] = OP_RUN | (run - 1);
+			run = 0;
+		}
+
+		int h = hash(px);
+		if(index[h].v == px.v){
+			out[p++] = OP_INDEX | h;
+		}else{
+			index[h] = px;
+
+			if(px.rgba.a == px_prev.rgba.a){
+				signed char vr = px.rgba.r - px_prev.rgba.r;
+				signed char vg = px.rgba.g - px_prev.rgba.g;
+				signed char vb = px.rgba.b - px_prev.rgba.b;
+
+				signed char vg_r = vr - vg;
+				signed char vg_b = vb - vg;
+
+				if(vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2){
+					out[p++] = OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+				}else if(vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8){
+					out[p++] = OP_LUMA | (vg + 32);
+					out[p++] = (vg_r + 8) << 4 | (vg_b + 8);
+				}else{
+					out[p++] = OP_RGB;
+					out[p++] = px.rgba.r;
+					out[p++] = px.rgba.g;
+					out[p++] = px.rgba.b;
+				}
+			}else{
+				out[p++] = OP_RGBA;
+				out[p++] = px.rgba.r;
+				out[p++] = px.rgba.g;
+				out[p++] = px.rgba.b;
+				out[p++] = px.rgba.a;
+			}
+		}
+		px_prev = px;
+	}
+
+	for(int i = 0; i < PADDING_SIZE; i++)
+		out[p++] = padding[i];
+
+	res.resize(p);
+	return res;
+}
+
+////////////////////////////////////////////////////////////////////
+// Decodes into a caller provided buffer of width*height*channels bytes.
+// channels = 0 keeps the channel count stored in the file.
+// With flip = true the first row written is the bottom row of the image,
+// which is the order glTexImage2D expects.
+inline bool qoi_decode_into(const unsigned char* data, size_t size,
+		unsigned char* pixels, int channels = 0, bool flip = false){
+	using namespace qoi_detail;
+	QOIDesc desc;
+	if(!qoi_read_header(data, size, desc))
+		return false;
+
+	if(channels == 0)
+		channels = desc.channels;
+	if(channels != 3 && channels != 4)
+		return false;
+
+	Pixel index[64];
+	memset(index, 0, sizeof(index));
+
+	Pixel px;
+	px.rgba = {0, 0, 0, 255};
+
+	int p = HEADER_SIZE;
+	int chunks_len = size - PADDING_SIZE;
+	int run = 0;
+
+	size_t row_size = (size_t)desc.width*channels;
+	for(unsigned int y = 0; y < desc.height; y++){
+		unsigned int row = flip? desc.height-1-y: y;
+		unsigned char* out = pixels + row*row_size;
+		unsigned char* end = out + row_size;
+		for(; out != end; out += channels){
+			if(run > 0){
+				run--;
+			}else if(p < chunks_len){
+				int b1 = data[p++];
+
+				if(b1 == OP_RGB){
+					px.rgba.r = data[p++];
+					px.rgba.g = data[p++];
+					px.rgba.b = data[p++];
+				}else if(b1 == OP_RGBA){
+					px.rgba.r = data[p++];
+					px.rgba.g = data[p++];
+					px.rgba.b = data[p++];
+					px.rgba.a = data[p++];
+				}else if((b1 & MASK_2) == OP_INDEX){
+					px = index[b1];
+				}else if((b1 & MASK_2) == OP_DIFF){
+					px.rgba.r += ((b1 >> 4) & 0x03) - 2;
+					px.rgba.g += ((b1 >> 2) & 0x03) - 2;
+					px.rgba.b += ( b1       & 0x03) - 2;
+				}else if((b1 & MASK_2) == OP_LUMA){
+					int b2 = data[p++];
+					int vg = (b1 & 0x3f) - 32;
+					px.rgba.r += vg - 8 + ((b2 >> 4) & 0x0f);
+					px.rgba.g += vg;
+					px.rgba.b += vg - 8 +  (b2       & 0x0f);
+				}else if((b1 & MASK_2) == OP_RUN){
+					run = (b1 & 0x3f);
+				}
+
+				index[hash(px)] = px;
+			}
+
+			out[0] = px.rgba.r;
+			out[1] = px.rgba.g;
+			out[2] = px.rgba.b;
+			if(channels == 4)
+				out[3] = px.rgba.a;
+		}
+	}
+
+	return true;
+}
+
+////////////////////////////////////////////////////////////////////
+// Returns a malloc'd buffer (release with free) or nullptr on failure.
+inline unsigned char* qoi_decode(const unsigned char* data, size_t size,
+		QOIDesc& desc, int channels = 0, bool flip = false){
+	if(!qoi_read_header(data, size, desc))
+		return nullptr;
+
+	if(channels == 0)
+		channels = desc.channels;
+
+	size_t n = (size_t)desc.width*desc.height*channels;
+	unsigned char* pixels = (unsigned char*)malloc(n);
+	if(pixels == nullptr)
+		return nullptr;
+
+	if(!qoi_decode_into(data, size, pixels, channels, flip)){
+		free(pixels);
+		return nullptr;
+	}
+	desc.channels = channels;
+	return pixels;
+}
+
+////////////////////////////////////////////////////////////////////
+inline std::vector<unsigned char> qoi_read_file(std::string filename){
+	std::ifstream in(filename, std::ios::binary);
+	return {std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+}
+
+inline bool qoi_write_file(std::string filename, const unsigned char* pixels, QOIDesc desc){
+	std::vector<unsigned char> data = qoi_encode(pixels, desc);
+	if(data.empty())
+		return false;
+	std::ofstream out(filename, std::ios::binary);
+	out.write((const char*)data.data(), data.size());
+	return out.good();
+}
+
+inline bool is_qoi_file(std::string filename){
+	size_t n = filename.size();
+	return n > 4 && filename.compare(n-4, 4, ".qoi") == 0;
+}
+
+#endif
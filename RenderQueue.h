@@ -0,0 +1,118 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <vector>
+#include <array>
+#include <map>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+class GLMesh;
+
+// One material range of a mesh, see GLMesh::enqueue.
+struct RenderItem{
+	uint64_t key;
+	const GLMesh* mesh;
+	unsigned int packet;
+	unsigned int version; // of the mesh's packets when enqueued
+};
+
+////////////////////////////////////////////////////////////////////
+// The draws of a frame, sorted so that consecutive draws share as much
+// state as possible. The key holds, from the most significant bits:
+//
+//   pass         2 bits   opaque, then alpha tested
+//   program      8 bits   ShaderPermutations key
+//   texture set 16 bits   the textures bound to units 0-2
+//   vao         14 bits
+//   depth       24 bits   view space distance, front to back
+//
+// so the program changes least often and, among draws with the same
+// state, near objects are drawn first and hide the far ones early.
+class RenderQueue{
+	std::vector<RenderItem> items;
+	std::vector<RenderItem> scratch;
+	std::map<std::array<unsigned int, 3>, unsigned int> texture_sets;
+
+	public:
+	enum Pass{
+		OPAQUE_PASS = 0, // OPAQUE is a macro in wingdi.h
+		ALPHA_TESTED_PASS = 1
+	};
+
+	static uint64_t make_key(Pass pass, unsigned int program, unsigned int texture_set,
+			unsigned int vao, float depth){
+		return (uint64_t)pass << 62 |
+			(uint64_t)(program & 0xff) << 54 |
+			(uint64_t)(texture_set & 0xffff) << 38 |
+			(uint64_t)(vao & 0x3fff) << 24 |
+			depth_bits(depth);
+	}
+
+	// Non negative floats sort as their bit patterns do; the top 24 bits
+	// keep the exponent and 15 bits of mantissa.
+	static uint64_t depth_bits(float depth){
+		if(!(depth > 0))
+			return 0;
+		uint32_t bits;
+		memcpy(&bits, &depth, sizeof bits);
+		return bits >> 8;
+	}
+
+	// Small number naming a combination of textures, stable across frames.
+	unsigned int texture_set(const unsigned int textures[3]){
+		std::array<unsigned int, 3> set = {textures[0], textures[1], textures[2]};
+		auto it = texture_sets.find(set);
+		if(it != texture_sets.end())
+			return it->second;
+		if(texture_sets.size() > 0xffff)
+			texture_sets.clear();
+		unsigned int id = texture_sets.size();
+		texture_sets[set] = id;
+		return id;
+	}
+
+	void clear(){
+		items.clear();
+	}
+
+	void add(uint64_t key, const GLMesh* mesh, unsigned int packet, unsigned int version){
+		items.push_back({key, mesh, packet, version});
+	}
+
+	unsigned int size() const{
+		return items.size();
+	}
+
+	const RenderItem& operator[](unsigned int i) const{
+		return items[i];
+	}
+
+	// Least significant digit radix sort, one byte per pass. Bytes that
+	// are the same in every key are skipped, which are most of them in a
+	// small scene. Stable, so equal keys keep the order they were added.
+	void sort(){
+		unsigned int n = items.size();
+		scratch.resize(n);
+		for(int shift = 0; shift < 64; shift += 8){
+			unsigned int count[256] = {};
+			for(const RenderItem& item: items)
+				count[(item.key >> shift) & 0xff]++;
+			if(n == 0 || count[(items[0].key >> shift) & 0xff] == n)
+				continue;
+
+			unsigned int offset[256];
+			unsigned int sum = 0;
+			for(int d = 0; d < 256; d++){
+				offset[d] = sum;
+				sum += count[d];
+			}
+			for(const RenderItem& item: items)
+				scratch[offset[(item.key >> shift) & 0xff]++] = item;
+			items.swap(scratch);
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,433 @@
+#ifndef SCENE_BVH_H
+#define SCENE_BVH_H
+
+#include <vector>
+#include <memory>
+#include <future>
+#include <cmath>
+#include <algorithm>
+#include "matrix.h"
+#include "Culling.h"
+
+////////////////////////////////////////////////////////////////////
+struct AABB{
+	vec3 min = {INFINITY, INFINITY, INFINITY};
+	vec3 max = {-INFINITY, -INFINITY, -INFINITY};
+
+	void expand(vec3 p){
+		min = {std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z)};
+		max = {std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z)};
+	}
+
+	void expand(const AABB& b){
+		if(b.empty())
+			return;
+		expand(b.min);
+		expand(b.max);
+	}
+
+	bool empty() const{
+		return min.x > max.x;
+	}
+
+	vec3 center() const{
+		return 0.5*(min + max);
+	}
+
+	float area() const{
+		if(empty())
+			return 0;
+		vec3 d = max - min;
+		return 2*(d.x*d.y + d.y*d.z + d.z*d.x);
+	}
+};
+
+// Box around [bbox_min, bbox_max] after Model.
+inline AABB transform_box(mat4 Model, vec3 bbox_min, vec3 bbox_max){
+	AABB box;
+	for(int i = 0; i < 8; i++){
+		vec3 p = {
+			(i & 1)? bbox_max.x: bbox_min.x,
+			(i & 2)? bbox_max.y: bbox_min.y,
+			(i & 4)? bbox_max.z: bbox_min.z
+		};
+		box.expand(toVec3(Model*toVec4(p, 1)));
+	}
+	return box;
+}
+
+////////////////////////////////////////////////////////////////////
+// Bounding volume hierarchy over the world space boxes of the objects
+// of a scene, for frustum, ray and sphere queries.
+//
+// build() splits by the surface area heuristic, evaluated in a few bins
+// along the longest axis, and builds large subtrees in parallel. The tree
+// is then stored depth first in one array: the left child of a node is
+// the next node, so a traversal mostly walks forward in memory.
+//
+// When objects move, set_bounds() and then refit() update the boxes of
+// the nodes above them, keeping the topology. Rebuild when the tree has
+// become loose.
+class SceneBVH{
+	public:
+	struct Node{
+		vec3 min;
+		unsigned int first; // leaf: first in objects; inner node: right child
+		vec3 max;
+		unsigned int count; // objects in a leaf, 0 for inner nodes
+	};
+	static_assert(sizeof(Node) == 32, "two nodes per cache line");
+
+	std::vector<Node> nodes;
+	std::vector<unsigned int> objects; // object indices, grouped by leaf
+
+	static const int bins = 12;
+	static const unsigned int max_leaf = 4;
+	// subtrees with more objects than this are built by another thread
+	static const unsigned int parallel_threshold = 8192;
+	static const int max_parallel_depth = 6;
+
+	unsigned int size() const{
+		return bounds.size();
+	}
+
+	void build(const std::vector<AABB>& boxes){
+		bounds = boxes;
+		unsigned int n = bounds.size();
+		prims.resize(n);
+		for(unsigned int i = 0; i < n; i++)
+			prims[i] = {bounds[i], bounds[i].center(), i};
+
+		nodes.clear();
+		parent.clear();
+		dirty.clear();
+		leaf_of.assign(n, 0);
+		if(n == 0)
+			return;
+
+		std::unique_ptr<BuildNode> root = build_node(0, n, 0);
+		objects.resize(n);
+		for(unsigned int i = 0; i < n; i++)
+			objects[i] = prims[i].index;
+		prims.clear();
+
+		flatten(*root, ~0u);
+		dirty.assign(nodes.size(), 0);
+	}
+
+	void set_bounds(unsigned int object, const AABB& box){
+		bounds[object] = box;
+		for(unsigned int n = leaf_of[object]; n != ~0u && !dirty[n]; n = parent[n])
+			dirty[n] = 1;
+	}
+
+	// Recomputes the boxes of the nodes above the objects given to set_bounds.
+	void refit(){
+		// children are stored after their parents
+		for(unsigned int i = nodes.size(); i-- > 0;){
+			if(!dirty[i])
+				continue;
+			dirty[i] = 0;
+
+			Node& node = nodes[i];
+			AABB box;
+			if(node.count > 0){
+				for(unsigned int k = node.first; k < node.first + node.count; k++)
+					box.expand(bounds[objects[k]]);
+			}else{
+				box.expand(node_box(nodes[i+1]));
+				box.expand(node_box(nodes[node.first]));
+			}
+			node.min = box.min;
+			node.max = box.max;
+		}
+	}
+
+	// Calls f(object) for every object whose box is not outside frustum.
+	template<class F>
+	void query(const Frustum& frustum, F f) const{
+		if(nodes.empty())
+			return;
+
+		// planes holds the bits of the planes a node is not known to be inside of
+		struct Entry{ unsigned int node; int planes; };
+		Entry stack[64];
+		int top = 0;
+		stack[top++] = {0, 0x3f};
+
+		while(top > 0){
+			Entry e = stack[--top];
+			const Node& node = nodes[e.node];
+			int planes = classify(frustum, node.min, node.max, e.planes);
+			if(planes < 0)
+				continue;
+
+			if(planes == 0){
+				visit_all(e.node, f);
+			}else if(node.count > 0){
+				for(unsigned int k = node.first; k < node.first + node.count; k++){
+					const AABB& b = bounds[objects[k]];
+					if(classify(frustum, b.min, b.max, planes) >= 0)
+						f(objects[k]);
+				}
+			}else{
+				stack[top++] = {node.first, planes};
+				stack[top++] = {e.node+1, planes};
+			}
+		}
+	}
+
+	// Calls f(object) for every object whose box overlaps the sphere.
+	template<class F>
+	void query(vec3 center, float radius, F f) const{
+		if(nodes.empty())
+			return;
+
+		auto overlaps = [&](vec3 min, vec3 max){
+			vec3 q = {
+				std::max(min.x, std::min(center.x, max.x)),
+				std::max(min.y, std::min(center.y, max.y)),
+				std::max(min.z, std::min(center.z, max.z))
+			};
+			vec3 d = q - center;
+			return dot(d, d) <= radius*radius;
+		};
+
+		unsigned int stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while(top > 0){
+			const Node& node = nodes[stack[--top]];
+			if(!overlaps(node.min, node.max))
+				continue;
+			if(node.count > 0){
+				for(unsigned int k = node.first; k < node.first + node.count; k++)
+					if(overlaps(bounds[objects[k]].min, bounds[objects[k]].max))
+						f(objects[k]);
+				continue;
+			}
+			stack[top++] = node.first;
+			stack[top++] = &node - nodes.data() + 1;
+		}
+	}
+
+	// Nearest object whose box the ray origin + t*dir (t >= 0) enters,
+	// or -1. hit receives its t.
+	int raycast(vec3 origin, vec3 dir, float& hit) const{
+		int best = -1;
+		hit = INFINITY;
+		if(nodes.empty())
+			return best;
+
+		vec3 inv = {1/dir.x, 1/dir.y, 1/dir.z};
+		auto entry = [&](vec3 min, vec3 max){
+			float t0 = 0, t1 = hit;
+			for(int a = 0; a < 3; a++){
+				float o = a == 0? origin.x: a == 1? origin.y: origin.z;
+				float i = a == 0? inv.x: a == 1? inv.y: inv.z;
+				float slab_min = a == 0? min.x: a == 1? min.y: min.z;
+				float slab_max = a == 0? max.x: a == 1? max.y: max.z;
+				// parallel to the slab: inside it or not, for any t (the
+				// products below would be 0*inf = NaN on its planes)
+				if(std::isinf(i)){
+					if(o < slab_min || o > slab_max)
+						return INFINITY;
+					continue;
+				}
+				float lo = (slab_min - o)*i;
+				float hi = (slab_max - o)*i;
+				if(lo > hi)
+					std::swap(lo, hi);
+				t0 = std::max(t0, lo);
+				t1 = std::min(t1, hi);
+			}
+			return t0 <= t1? t0: INFINITY;
+		};
+
+		unsigned int stack[64];
+		int top = 0;
+		stack[top++] = 0;
+		while(top > 0){
+			const Node& node = nodes[stack[--top]];
+			if(entry(node.min, node.max) == INFINITY)
+				continue;
+			if(node.count > 0){
+				for(unsigned int k = node.first; k < node.first + node.count; k++){
+					const AABB& b = bounds[objects[k]];
+					float t = entry(b.min, b.max);
+					if(t < hit){
+						hit = t;
+						best = objects[k];
+					}
+				}
+				continue;
+			}
+			// nearer child first
+			unsigned int left = &node - nodes.data() + 1, right = node.first;
+			float tl = entry(nodes[left].min, nodes[left].max);
+			float tr = entry(nodes[right].min, nodes[right].max);
+			if(tl < tr)
+				std::swap(left, right);
+			stack[top++] = left;
+			stack[top++] = right;
+		}
+		return best;
+	}
+
+	private:
+	std::vector<AABB> bounds;
+	// objects are partitioned along with copies of their boxes,
+	// which are then read in order
+	struct Prim{
+		AABB box;
+		vec3 center;
+		unsigned int index;
+	};
+	std::vector<Prim> prims;
+	std::vector<unsigned int> parent;
+	std::vector<unsigned int> leaf_of;
+	std::vector<char> dirty;
+
+	struct BuildNode{
+		AABB box;
+		unsigned int first = 0, count = 0;
+		std::unique_ptr<BuildNode> child[2];
+	};
+
+	static AABB node_box(const Node& node){
+		AABB b;
+		b.min = node.min;
+		b.max = node.max;
+		return b;
+	}
+
+	// -1 if the box is outside a plane in planes, otherwise planes 
+	// without those the box is completely inside of.
+	static int classify(const Frustum& frustum, vec3 min, vec3 max, int planes){
+		for(int p = 0; p < 6; p++){
+			if(!(planes & 1 << p))
+				continue;
+			vec4 P = frustum.planes[p];
+			// corners farthest along and against the plane normal
+			vec3 far = {P.x > 0? max.x: min.x, P.y > 0? max.y: min.y, P.z > 0? max.z: min.z};
+			vec3 near = {P.x > 0? min.x: max.x, P.y > 0? min.y: max.y, P.z > 0? min.z: max.z};
+			if(dot(toVec3(P), far) + P.w < 0)
+				return -1;
+			if(dot(toVec3(P), near) + P.w >= 0)
+				planes &= ~(1 << p);
+		}
+		return planes;
+	}
+
+	static float axis(vec3 v, int a){
+		return a == 0? v.x: a == 1? v.y: v.z;
+	}
+
+	std::unique_ptr<BuildNode> build_node(unsigned int first, unsigned int end, int depth){
+		std::unique_ptr<BuildNode> node{new BuildNode};
+		AABB centroid_box;
+		for(unsigned int i = first; i < end; i++){
+			node->box.expand(prims[i].box);
+			centroid_box.expand(prims[i].center);
+		}
+
+		unsigned int n = end - first;
+		if(n <= max_leaf || depth >= 60)
+			return make_leaf(std::move(node), first, n);
+
+		vec3 extent = centroid_box.max - centroid_box.min;
+		int a = extent.x > extent.y && extent.x > extent.z? 0: extent.y > extent.z? 1: 2;
+		float lo = axis(centroid_box.min, a), size = axis(extent, a);
+
+		unsigned int mid;
+		if(size <= 0){
+			// all centers coincide: split in half
+			mid = first + n/2;
+		}else{
+			struct Bin{ AABB box; unsigned int count = 0; } bin[bins];
+			float scale = bins/size;
+			auto bin_of = [&](const Prim& p){
+				return std::min(bins-1, (int)((axis(p.center, a) - lo)*scale));
+			};
+			for(unsigned int i = first; i < end; i++){
+				Bin& b = bin[bin_of(prims[i])];
+				b.box.expand(prims[i].box);
+				b.count++;
+			}
+
+			// cost of splitting after each bin, sweeping from both sides
+			float right_cost[bins];
+			AABB box;
+			unsigned int count = 0;
+			for(int i = bins-1; i > 0; i--){
+				box.expand(bin[i].box);
+				count += bin[i].count;
+				right_cost[i] = count*box.area();
+			}
+			float best_cost = INFINITY;
+			int best = -1;
+			box = AABB{};
+			count = 0;
+			for(int i = 0; i < bins-1; i++){
+				box.expand(bin[i].box);
+				count += bin[i].count;
+				float cost = count*box.area() + right_cost[i+1];
+				if(count > 0 && count < n && cost < best_cost){
+					best_cost = cost;
+					best = i;
+				}
+			}
+
+			if(best < 0 || (n <= 4*max_leaf && best_cost >= n*node->box.area()))
+				return make_leaf(std::move(node), first, n);
+
+			mid = std::partition(prims.begin() + first, prims.begin() + end,
+				[&](const Prim& p){ return bin_of(p) <= best; }) - prims.begin();
+		}
+
+		if(n > parallel_threshold && depth < max_parallel_depth){
+			auto left = std::async(std::launch::async, &SceneBVH::build_node, this, first, mid, depth+1);
+			node->child[1] = build_node(mid, end, depth+1);
+			node->child[0] = left.get();
+		}else{
+			node->child[0] = build_node(first, mid, depth+1);
+			node->child[1] = build_node(mid, end, depth+1);
+		}
+		return node;
+	}
+
+	std::unique_ptr<BuildNode> make_leaf(std::unique_ptr<BuildNode> node, unsigned int first, unsigned int n){
+		node->first = first;
+		node->count = n;
+		return node;
+	}
+
+	unsigned int flatten(const BuildNode& b, unsigned int parent_index){
+		unsigned int index = nodes.size();
+		nodes.push_back({b.box.min, b.first, b.box.max, b.count});
+		parent.push_back(parent_index);
+		if(b.count > 0){
+			for(unsigned int k = b.first; k < b.first + b.count; k++)
+				leaf_of[objects[k]] = index;
+		}else{
+			flatten(*b.child[0], index);
+			unsigned int right = flatten(*b.child[1], index);
+			nodes[index].first = right;
+		}
+		return index;
+	}
+
+	template<class F>
+	void visit_all(unsigned int index, F& f) const{
+		const Node& node = nodes[index];
+		if(node.count > 0){
+			for(unsigned int k = node.first; k < node.first + node.count; k++)
+				f(objects[k]);
+			return;
+		}
+		visit_all(index+1, f);
+		visit_all(node.first, f);
+	}
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef SHADER_PERMUTATIONS_H
+#define SHADER_PERMUTATIONS_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include <functional>
+#include "GLutils.h"
+
+////////////////////////////////////////////////////////////////////
+// Variants of a vertex/fragment shader pair specialized with #defines
+// (see PhongTexLights.frag): which maps the material has, whether it
+// needs the alpha test and up to how many lights are shaded. A variant
+// is compiled the first time it is asked for, or together with others
+// by prepare(), and kept by its key. Variants without the alpha test
+// have no discard, so the GPU can depth test before shading.
+//
+// Uniforms shared by every variant (View, Projection, ...) are set with
+// set(), which also applies them to the variants compiled later.
+class ShaderPermutations{
+	Shader vertex;
+	Shader fragment;
+	std::map<unsigned int, ShaderProgram> programs;
+	std::map<std::string, std::function<void(unsigned int)>> shared;
+	std::vector<std::string> defines;
+	unsigned int light_key = 3 << 4;
+
+	public:
+	enum Bits{
+		MAP_KA = 1,
+		MAP_KD = 2,
+		MAP_KS = 4,
+		ALPHA_TEST = 8,
+		MATERIAL_BITS = 15
+		// bits 4-5: light bucket
+	};
+
+	static int bucket_lights(int bucket){
+		const int lights[] = {1, 4, 8, 16};
+		return lights[bucket];
+	}
+
+	// defines are added to the fragment shader of every variant.
+	ShaderPermutations(std::string vertex_file, std::string fragment_file, 
+			std::vector<std::string> defines = {})
+		: vertex{vertex_file, GL_VERTEX_SHADER}, fragment{fragment_file, GL_FRAGMENT_SHADER},
+		  defines{defines}
+	{}
+
+	// Variants compiled from now on shade at least n_lights lights.
+	void set_lights(int n_lights){
+		int bucket = 0;
+		while(bucket < 3 && bucket_lights(bucket) < n_lights)
+			bucket++;
+		light_key = bucket << 4;
+	}
+
+	// key: the map bits of the material and ALPHA_TEST if it needs it.
+	const ShaderProgram& get(unsigned int key){
+		key = (key & MATERIAL_BITS) | light_key;
+		auto it = programs.find(key);
+		if(it != programs.end())
+			return it->second;
+
+		ShaderProgram& program = programs[key];
+		program = ShaderProgram{vertex, variant(key)};
+		apply_shared(program);
+		return program;
+	}
+
+	// The variant that samples every map, to see which samplers exist.
+	const ShaderProgram& reference(){
+		return get(MAP_KA | MAP_KD | MAP_KS | ALPHA_TEST);
+	}
+
+	// Compiles the missing variants of keys in one ShaderBatch.
+	void prepare(const std::vector<unsigned int>& keys){
+		ShaderBatch batch;
+		std::vector<ShaderProgram*> added;
+		for(unsigned int key: keys){
+			key = (key & MATERIAL_BITS) | light_key;
+			if(programs.find(key) != programs.end())
+				continue;
+			ShaderProgram& program = programs[key];
+			batch.add(program, vertex, variant(key));
+			added.push_back(&program);
+		}
+		batch.finish();
+		for(ShaderProgram* program: added)
+			apply_shared(*program);
+	}
+
+	template<class T>
+	void set(const std::string& name, T value){
+		auto f = [name, value](unsigned int program){
+			Uniform{program, name} = value;
+		};
+		for(auto& it: programs)
+			f(it.second);
+		shared[name] = f;
+	}
+
+	int size() const{ return programs.size(); }
+
+	private:
+	Shader variant(unsigned int key) const{
+		std::vector<std::string> d = {
+			"PERMUTATION",
+			std::string("MAP_KA ") + (key & MAP_KA? "true": "false"),
+			std::string("MAP_KD ") + (key & MAP_KD? "true": "false"),
+			std::string("MAP_KS ") + (key & MAP_KS? "true": "false"),
+			std::string("ALPHA_TEST ") + (key & ALPHA_TEST? "1": "0"),
+			"LIGHTS " + std::to_string(bucket_lights(key >> 4 & 3))
+		};
+		d.insert(d.end(), defines.begin(), defines.end());
+		return fragment.with_defines(d);
+	}
+
+	void apply_shared(const ShaderProgram& program){
+		for(auto& it: shared)
+			it.second(program);
+	}
+};
+
+#endif
@@ -0,0 +1,11 @@
+#version 330
+
+uniform samplerCube skybox;
+
+in vec3 texCoords;
+
+out vec4 FragColor;
+
+void main(){     
+	FragColor = texture(skybox, texCoords);
+}
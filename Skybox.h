@@ -0,0 +1,113 @@
+#ifndef SKYBOX_H
+#define SKYBOX_H
+
+#include <array>
+#include "GLutils.h"
+
+////////////////////////////////////////////////////////////////////
+// Cube map drawn around the camera at maximum depth. 
+// Draw it after the opaque geometry: early depth test then rejects 
+// every covered pixel and only the visible sky is shaded.
+struct Skybox{
+	GLTexture texture;
+	VAO vao;
+	GLBuffer vbo;
+	ShaderProgram program;
+
+	Skybox() = default;
+
+	// Faces in the order +X, -X, +Y, -Y, +Z, -Z.
+	Skybox(const std::array<std::string, 6>& faces){
+		init();
+		texture.load_cubemap(faces);
+	}
+
+	Skybox(const std::array<Image, 6>& faces){
+		init();
+		for(int i = 0; i < 6; i++)
+			texture.load(faces[i], GL_TEXTURE_CUBE_MAP_POSITIVE_X+i);
+		set_cubemap_params();
+	}
+
+	void draw(mat4 View, mat4 Projection) const{
+		depth_func(GL_LEQUAL);
+		depth_mask(false);
+
+		use_program(program);
+		Uniform{"View"} = View;
+		Uniform{"Projection"} = Projection;
+		Uniform{"skybox"} = 0;
+
+		bind_texture_unit(0, GL_TEXTURE_CUBE_MAP, texture);
+		bind_vertex_array(vao);
+		glDrawArrays(GL_TRIANGLES, 0, 36);
+
+		depth_mask(true);
+		depth_func(GL_LESS);
+	}
+
+	private:
+	void init(){
+		program = ShaderProgram{
+			Shader{"Skybox.vert", GL_VERTEX_SHADER},
+			Shader{"Skybox.frag", GL_FRAGMENT_SHADER}
+		};
+
+		std::vector<vec3> V;
+		vec3 P[8];
+		for(int i = 0; i < 8; i++)
+			P[i] = {i&1? 1.0f: -1.0f, i&2? 1.0f: -1.0f, i&4? 1.0f: -1.0f};
+
+		int faces[6][4] = {
+			{1, 5, 7, 3}, {4, 0, 2, 6}, {2, 3, 7, 6},
+			{4, 5, 1, 0}, {5, 4, 6, 7}, {0, 1, 3, 2}
+		};
+		for(auto f: faces)
+			V.insert(V.end(), {P[f[0]], P[f[1]], P[f[2]], P[f[0]], P[f[2]], P[f[3]]});
+
+		vao = VAO{true};
+		bind_vertex_array(vao);
+
+		vbo = GLBuffer{GL_ARRAY_BUFFER};
+		vbo.data(V, GL_STATIC_DRAW);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+
+		texture = GLTexture{GL_TEXTURE_CUBE_MAP};
+	}
+};
+
+// Sky gradient in the faces of a cube map, for when there are no images.
+inline std::array<Image, 6> procedural_sky(int size, vec3 zenith, vec3 horizon, vec3 ground){
+	std::array<Image, 6> faces;
+	for(int f = 0; f < 6; f++){
+		Image& img = faces[f];
+		img.width = img.height = size;
+		img.channels = 3;
+		img.pixels.reset((unsigned char*)malloc(img.size()));
+
+		unsigned char* p = img.pixels.get();
+		for(int j = 0; j < size; j++){
+			for(int i = 0; i < size; i++){
+				float s = 2*(i + 0.5f)/size - 1;
+				float t = 2*(j + 0.5f)/size - 1;
+
+				// direction of the texel (OpenGL cube map face orientation)
+				vec3 dirs[6] = {
+					{1, -t, -s}, {-1, -t, s}, {s, 1, t},
+					{s, -1, -t}, {s, -t, 1}, {-s, -t, -1}
+				};
+				float y = normalize(dirs[f]).y;
+
+				vec3 c = (y >= 0)? lerp(sqrt(y), horizon, zenith): lerp(sqrt(-y), horizon, ground);
+				*p++ = 255*clamp(c.x, 0, 1);
+				*p++ = 255*clamp(c.y, 0, 1);
+				*p++ = 255*clamp(c.z, 0, 1);
+			}
+		}
+	}
+	return faces;
+}
+
+#endif
@@ -0,0 +1,19 @@
+#version 330
+
+uniform mat4 Projection; 
+uniform mat4 View; 
+
+layout(location=0) in vec3 Position;
+
+out vec3 texCoords;
+
+void main(){
+	texCoords = Position;
+
+	// apenas a rotação da câmera: o céu fica no infinito
+	vec4 pos = Projection*mat4(mat3(View))*vec4(Position, 1);
+
+	// z = w: após a divisão perspectiva a profundidade é máxima, então
+	// com GL_LEQUAL o céu só aparece onde nada foi desenhado
+	gl_Position = pos.xyww;
+} 
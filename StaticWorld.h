@@ -0,0 +1,246 @@
+#ifndef STATIC_WORLD_H
+#define STATIC_WORLD_H
+
+#include <vector>
+#include <algorithm>
+#include "GLMesh.h"
+
+// Layout of glMultiDrawElementsIndirect commands.
+struct DrawElementsIndirectCommand{
+	unsigned int count;
+	unsigned int instanceCount;
+	unsigned int firstIndex;
+	int baseVertex;
+	unsigned int baseInstance;
+};
+
+////////////////////////////////////////////////////////////////////
+// Meshes that never move, packed into one vertex buffer and one index
+// buffer behind a single VAO, and drawn with one
+// glMultiDrawElementsIndirect per bucket of material ranges that share
+// the shader variant and the textures.
+//
+// Shaders cannot tell the draws of a multi draw apart by any built-in
+// in GL 3.3, so each command gets baseInstance = its position, and an
+// instanced attribute (divisor 1) reads (object, material) at that
+// position. StaticWorld.vert fetches the matrices of the object and the
+// material from texture buffers with them.
+//
+// Without ARB_multi_draw_indirect and ARB_base_instance the commands
+// are issued one by one with glDrawElementsBaseVertex, the attribute
+// set with glVertexAttribI2i.
+//
+// The meshes passed to build() must stay where they are. Their textures
+// are still loaded and streamed by them; TextureArrays are not supported.
+class StaticWorld{
+	struct Object{
+		const GLMesh* mesh;
+		unsigned int first_index;
+		int base_vertex;
+		unsigned int first_material;
+	};
+
+	struct MaterialTexels{
+		vec4 Ka_shininess;
+		vec4 Kd;
+		vec4 Ks;
+	};
+
+	struct Draw{
+		unsigned int key;
+		unsigned int textures[3];
+		DrawElementsIndirectCommand command;
+		int info[2]; // object slot, material
+	};
+
+	std::vector<Object> objects;
+	VAO vao;
+	GLBuffer vbo;
+	GLBuffer ebo;
+	GLBuffer info_buffer;
+	GLBuffer command_buffer;
+	GLBuffer object_buffer;
+	GLBuffer material_buffer;
+	GLTexture object_texture;
+	GLTexture material_texture;
+	bool indirect = false;
+
+	// per frame
+	std::vector<ObjectStd140> object_data;
+	std::vector<Draw> draws;
+	std::vector<DrawElementsIndirectCommand> commands;
+	std::vector<int> infos;
+
+	public:
+	ShaderPermutations permutations;
+
+	struct Stats{
+		int objects = 0;
+		int draws = 0;    // material ranges
+		int buckets = 0;
+		int calls = 0;    // GL draw calls
+	}stats;
+
+	StaticWorld(std::string fragment_file = "PhongTexLights.frag")
+		: permutations{"StaticWorld.vert", fragment_file, {"PER_DRAW_MATERIAL"}}
+	{
+		permutations.set("map_Ka", 0);
+		permutations.set("map_Kd", 1);
+		permutations.set("map_Ks", 2);
+		permutations.set("objects", 3);
+		permutations.set("materials", 4);
+	}
+
+	// Copies the geometry and materials of meshes.
+	void build(const std::vector<GLMesh>& meshes){
+		indirect = GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance;
+
+		std::vector<Vertex> vertices;
+		std::vector<unsigned int> indices;
+		std::vector<MaterialTexels> materials;
+		objects.clear();
+
+		for(const GLMesh& mesh: meshes){
+			std::vector<Vertex> V;
+			std::vector<unsigned int> I;
+			mesh.read_geometry(V, I);
+
+			objects.push_back({&mesh, (unsigned int)indices.size(), (int)vertices.size(),
+				(unsigned int)materials.size()});
+			vertices.insert(vertices.end(), V.begin(), V.end());
+			indices.insert(indices.end(), I.begin(), I.end());
+
+			for(unsigned int i = 0; i < mesh.material_count(); i++){
+				const MaterialInfo& mat = mesh.material(i);
+				materials.push_back({toVec4(mat.Ka, mat.Ns), toVec4(mat.Kd, 0), toVec4(mat.Ks, 0)});
+			}
+		}
+
+		vao = VAO{true};
+		bind_vertex_array(vao);
+
+		vbo = GLBuffer{GL_ARRAY_BUFFER};
+		vbo.data(vertices, GL_STATIC_DRAW);
+		vertex_layout(vbo);
+
+		info_buffer = GLBuffer{GL_ARRAY_BUFFER};
+		bind_buffer(GL_ARRAY_BUFFER, info_buffer);
+		if(indirect){
+			glEnableVertexAttribArray(3);
+			glVertexAttribIPointer(3, 2, GL_INT, 0, 0);
+			glVertexAttribDivisor(3, 1);
+		}
+
+		// the element array binding is part of the VAO
+		ebo = GLBuffer{GL_ELEMENT_ARRAY_BUFFER};
+		ebo.data(indices, GL_STATIC_DRAW);
+
+		command_buffer = GLBuffer{GL_DRAW_INDIRECT_BUFFER};
+
+		material_buffer = GLBuffer{GL_TEXTURE_BUFFER};
+		material_buffer.data(materials, GL_STATIC_DRAW);
+		material_texture = GLTexture{GL_TEXTURE_BUFFER};
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, material_buffer);
+
+		// glGenBuffers only reserves the name; glTexBuffer needs the
+		// buffer object, which the first data() creates. Later data()
+		// calls replace its store, and the texture follows them.
+		object_buffer = GLBuffer{GL_TEXTURE_BUFFER};
+		object_buffer.data(std::vector<ObjectStd140>(1), GL_STREAM_DRAW);
+		object_texture = GLTexture{GL_TEXTURE_BUFFER};
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, object_buffer);
+
+		std::cout << "static world: " << objects.size() << " meshes, " << vertices.size()
+			<< " vertices, " << indices.size() << " indices, "
+			<< (indirect? "glMultiDrawElementsIndirect": "glDrawElementsBaseVertex") << '\n';
+	}
+
+	// Draws the objects listed in visible (indices into the meshes given
+	// to build), their matrices computed here as in TransformStage.
+	void draw(mat4 View, mat4 Projection, const std::vector<unsigned int>& visible){
+		stats = {};
+		if(objects.empty() || visible.empty())
+			return;
+
+		mat4 PV;
+		mat4_mul(Projection, View, PV);
+
+		object_data.resize(visible.size());
+		draws.clear();
+		for(unsigned int slot = 0; slot < visible.size(); slot++){
+			const Object& object = objects[visible[slot]];
+			const mat4& Model = object.mesh->Model;
+			ObjectStd140& o = object_data[slot];
+			mat4_mul(View, Model, o.ModelView);
+			mat4_mul(PV, Model, o.MVP);
+			normal_matrix(o.ModelView, o.NormalMatrix);
+
+			for(const DrawPacket& p: object.mesh->draw_packets()){
+				Draw d;
+				d.key = p.key;
+				std::copy(p.textures, p.textures + 3, d.textures);
+				d.command = {p.count, 1, object.first_index + p.first, object.base_vertex, 0};
+				d.info[0] = slot;
+				d.info[1] = object.first_material + p.material;
+				draws.push_back(d);
+			}
+		}
+
+		// buckets: same variant and textures
+		auto bucket_less = [](const Draw& a, const Draw& b){
+			if(a.key != b.key)
+				return a.key < b.key;
+			return std::lexicographical_compare(a.textures, a.textures + 3, b.textures, b.textures + 3);
+		};
+		std::stable_sort(draws.begin(), draws.end(), bucket_less);
+
+		commands.resize(draws.size());
+		infos.resize(2*draws.size());
+		for(unsigned int i = 0; i < draws.size(); i++){
+			commands[i] = draws[i].command;
+			commands[i].baseInstance = i;
+			infos[2*i] = draws[i].info[0];
+			infos[2*i+1] = draws[i].info[1];
+		}
+
+		object_buffer.data(object_data, GL_STREAM_DRAW);
+		info_buffer.data(infos, GL_STREAM_DRAW);
+		if(indirect)
+			command_buffer.data(commands, GL_STREAM_DRAW);
+
+		bind_vertex_array(vao);
+		bind_texture_unit(3, GL_TEXTURE_BUFFER, object_texture);
+		bind_texture_unit(4, GL_TEXTURE_BUFFER, material_texture);
+
+		stats.objects = visible.size();
+		stats.draws = draws.size();
+		for(unsigned int first = 0; first < draws.size();){
+			unsigned int end = first + 1;
+			while(end < draws.size() && !bucket_less(draws[first], draws[end]))
+				end++;
+
+			use_program(permutations.get(draws[first].key));
+			for(int unit = 0; unit < 3; unit++)
+				if(draws[first].textures[unit] != 0)
+					bind_texture_unit(unit, GL_TEXTURE_2D, draws[first].textures[unit]);
+
+			if(indirect){
+				glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+					(void*)(first*sizeof(DrawElementsIndirectCommand)), end - first, 0);
+				stats.calls++;
+			}else{
+				for(unsigned int i = first; i < end; i++){
+					const DrawElementsIndirectCommand& c = commands[i];
+					glVertexAttribI2i(3, infos[2*i], infos[2*i+1]);
+					glDrawElementsBaseVertex(GL_TRIANGLES, c.count, GL_UNSIGNED_INT,
+						(void*)(c.firstIndex*sizeof(unsigned int)), c.baseVertex);
+					stats.calls++;
+				}
+			}
+			stats.buckets++;
+			first = end;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,53 @@
+#version 330
+
+// Matrizes de cada objeto visível, 11 texels cada (ObjectStd140 em
+// Transforms.h: ModelView, MVP e NormalMatrix, por linhas)
+uniform samplerBuffer objects;
+
+// Ka e shininess, Kd, Ks: 3 texels por faixa de material
+uniform samplerBuffer materials;
+
+layout(location=0) in vec4 Position;
+layout(location=1) in vec2 TexCoords;
+layout(location=2) in vec3 Normal;
+
+// (objeto, material) do desenho: atributo por instância lido na posição
+// baseInstance do comando indireto (StaticWorld.h)
+layout(location=3) in ivec2 DrawInfo;
+
+out vec3 position;
+out vec3 normal;
+out vec2 texCoords;
+
+flat out vec3 Ka;
+flat out vec3 Kd;
+flat out vec3 Ks;
+flat out float shininess;
+
+void main(){
+	int o = 11*DrawInfo.x;
+
+	// as linhas viram colunas, daí o transpose
+	mat4 ModelView = transpose(mat4(
+		texelFetch(objects, o), texelFetch(objects, o+1),
+		texelFetch(objects, o+2), texelFetch(objects, o+3)));
+	mat4 MVP = transpose(mat4(
+		texelFetch(objects, o+4), texelFetch(objects, o+5),
+		texelFetch(objects, o+6), texelFetch(objects, o+7)));
+	mat3 NormalMatrix = transpose(mat3(
+		texelFetch(objects, o+8).xyz, texelFetch(objects, o+9).xyz,
+		texelFetch(objects, o+10).xyz));
+
+	gl_Position = MVP*Position;
+
+	position = vec3(ModelView*Position);
+	normal = normalize(NormalMatrix*Normal);
+	texCoords = TexCoords;
+
+	int m = 3*DrawInfo.y;
+	vec4 a = texelFetch(materials, m);
+	Ka = a.xyz;
+	shininess = a.w;
+	Kd = texelFetch(materials, m+1).xyz;
+	Ks = texelFetch(materials, m+2).xyz;
+}
@@ -0,0 +1,135 @@
+#ifndef TEXTURE_ARRAYS_H
+#define TEXTURE_ARRAYS_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include "GLutils.h"
+
+////////////////////////////////////////////////////////////////////
+// Groups textures of equal size and channel count into 
+// GL_TEXTURE_2D_ARRAYs, so that materials select a layer with a
+// uniform instead of binding a different texture.
+//
+// add() only decodes the image; build() puts the images added since
+// the previous call in arrays. An array is allocated with room for
+// more layers (up to array_bytes), which later builds fill with
+// glTexSubImage3D, so arrays are never read back or recreated and
+// their texture ids do not change.
+class TextureArrays{
+	struct Group{
+		int width, height, channels;
+		int capacity;
+		int levels;
+		std::vector<std::string> files;
+		GLTexture texture;
+	};
+
+	std::vector<Group> groups;
+	std::map<std::string, Image> staged;
+
+	public:
+	struct Layer{
+		int array = -1;
+		int layer = -1;
+	};
+
+	std::map<std::string, Layer> layers;
+
+	// Memory reserved by a new array, which bounds its layers.
+	size_t array_bytes = 64 << 20;
+
+	void add(std::string file){
+		if(file == "" || staged.find(file) != staged.end() || layers.find(file) != layers.end())
+			return;
+
+		Image img = load_image(file, true);
+		if(!img){
+			std::cout << "ERROR: could not read texture " << file << '\n';
+			return;
+		}
+		staged[file] = texture_policy.fit(std::move(img), TextureUsage::Color);
+	}
+
+	void build(){
+		if(staged.empty())
+			return;
+
+		int max_layers;
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+
+		int format[] = {0, GL_RED, GL_RG, GL_RGB, GL_RGBA};
+		pixel_alignment(GL_UNPACK_ALIGNMENT, 1);
+		for(auto& it: staged){
+			Image& img = it.second;
+			int g = 0;
+			while(g < (int)groups.size() && !(groups[g].width == img.width && 
+			      groups[g].height == img.height && groups[g].channels == img.channels &&
+			      (int)groups[g].files.size() < groups[g].capacity))
+				g++;
+
+			if(g == (int)groups.size())
+				add_group(img, max_layers);
+
+			Group& group = groups[g];
+			int layer = group.files.size();
+			layers[it.first] = {g, layer};
+			group.files.push_back(it.first);
+
+			// the mip levels of this layer only, the others are complete
+			bind_texture(GL_TEXTURE_2D_ARRAY, group.texture);
+			for(int l = 0; l < group.levels; l++){
+				if(l > 0)
+					img = downsample(img);
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, l, 0, 0, layer, img.width, img.height, 1,
+					format[group.channels], GL_UNSIGNED_BYTE, img.pixels.get());
+			}
+		}
+		staged.clear();
+	}
+
+	Layer find(const std::string& file) const{
+		auto it = layers.find(file);
+		return (it != layers.end())? it->second: Layer{};
+	}
+
+	unsigned int texture(int array) const{
+		return array < 0? 0: (unsigned int)groups[array].texture;
+	}
+
+	int size() const{ return groups.size(); }
+
+	private:
+	void add_group(const Image& img, int max_layers){
+		size_t layer_bytes = texture_policy.bytes(img.width, img.height, img.channels, TextureUsage::Color);
+		int capacity = std::max<size_t>(1, std::min<size_t>(max_layers, array_bytes/layer_bytes));
+		groups.push_back(Group{img.width, img.height, img.channels, capacity, mip_levels(img.width, img.height)});
+		Group& group = groups.back();
+
+		int format[] = {0, GL_RED, GL_RG, GL_RGB, GL_RGBA};
+		group.texture = GLTexture{GL_TEXTURE_2D_ARRAY};
+		GLenum internal_format = texture_policy.internal_format(group.channels, TextureUsage::Color);
+		for(int l = 0; l < group.levels; l++)
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, l, internal_format, std::max(1, group.width >> l),
+				std::max(1, group.height >> l), capacity, 0, format[group.channels], GL_UNSIGNED_BYTE, NULL);
+		set_gray_swizzle(GL_TEXTURE_2D_ARRAY, group.channels);
+		texture_policy.account(group.texture, capacity*layer_bytes);
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, group.levels-1);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		if(GLEW_EXT_texture_filter_anisotropic){
+			GLfloat fLargest;
+			glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &fLargest);
+			glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY_EXT, fLargest);
+		}
+
+		std::cout << "texture array " << groups.size()-1 << ": room for " << capacity << " layers " 
+			<< group.width << 'x' << group.height << 'x' << group.channels << '\n';
+	}
+};
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include "GLutils.h"
+
+////////////////////////////////////////////////////////////////////
+// Several small textures packed into a single RGBA image.
+//
+// Every texture is surrounded by a gutter of replicated border texels
+// and placed at a position multiple of the gutter size, so that
+// log2(gutter) mip levels can be generated without bleeding between
+// neighbours.
+struct TextureAtlas{
+	struct Rect{
+		int x, y, w, h;
+	};
+
+	Image image;
+	std::map<std::string, Rect> rects;
+	bool alpha = false; // some texture had an alpha channel
+	int gutter = 8;
+
+	// Coarsest mip level that does not blend neighbouring textures,
+	// log2(gutter); coarser levels must not be sampled.
+	int max_level() const{
+		int l = 0;
+		while((2 << l) <= gutter)
+			l++;
+		return l;
+	}
+
+	// Maps texture coordinates in [0,1] of file into the atlas.
+	vec2 transform(const std::string& file, vec2 uv) const{
+		const Rect& r = rects.at(file);
+		return {
+			(r.x + uv.x*r.w)/image.width,
+			(r.y + uv.y*r.h)/image.height
+		};
+	}
+};
+
+////////////////////////////////////////////////////////////////////
+inline int align_up(int v, int a){
+	return (v + a - 1)/a*a;
+}
+
+// Copies src (any channel count) into dst (RGBA) at x, y and
+// replicates its borders gutter texels outwards.
+inline void atlas_blit(Image& dst, const Image& src, int x, int y, int gutter){
+	int w = src.width, h = src.height, c = src.channels;
+	const unsigned char* sp = src.pixels.get();
+	unsigned char* dp = dst.pixels.get();
+
+	for(int j = -gutter; j < h + gutter; j++){
+		int sj = std::max(0, std::min(j, h-1));
+		int dy = y + j;
+		if(dy < 0 || dy >= dst.height)
+			continue;
+		for(int i = -gutter; i < w + gutter; i++){
+			int si = std::max(0, std::min(i, w-1));
+			int dx = x + i;
+			if(dx < 0 || dx >= dst.width)
+				continue;
+			const unsigned char* s = sp + ((size_t)sj*w + si)*c;
+			unsigned char* d = dp + ((size_t)dy*dst.width + dx)*4;
+			d[0] = s[0];
+			d[1] = c >= 3? s[1]: s[0];
+			d[2] = c >= 3? s[2]: s[0];
+			d[3] = c == 4? s[3]: c == 2? s[1]: 255;
+		}
+	}
+}
+
+// Packs the given images in as few atlases of at most max_size x max_size
+// as possible, using shelves sorted by height. Images that do not fit in
+// an empty atlas are left out.
+inline std::vector<TextureAtlas> build_atlases(const std::map<std::string, Image>& images,
+		int max_size = 2048, int gutter = 8){
+	struct Item{
+		const std::string* file;
+		const Image* img;
+	};
+
+	std::vector<Item> items;
+	for(auto& it: images)
+		if(it.second.width + 2*gutter <= max_size && it.second.height + 2*gutter <= max_size)
+			items.push_back({&it.first, &it.second});
+
+	std::sort(items.begin(), items.end(), [](Item a, Item b){
+		return a.img->height > b.img->height;
+	});
+
+	struct Placement{
+		const Item* item;
+		int x, y;
+	};
+	std::vector<std::vector<Placement>> layouts;
+	std::vector<int> used_width, used_height;
+
+	int shelf_x = 0, shelf_y = 0, shelf_h = 0;
+	for(const Item& item: items){
+		int w = align_up(item.img->width + 2*gutter, gutter);
+		int h = align_up(item.img->height + 2*gutter, gutter);
+
+		if(layouts.empty() || shelf_x + w > max_size){
+			// new shelf
+			shelf_y += shelf_h;
+			shelf_x = 0;
+			shelf_h = 0;
+		}
+		if(layouts.empty() || shelf_y + h > max_size){
+			// new atlas
+			layouts.emplace_back();
+			used_width.push_back(0);
+			used_height.push_back(0);
+			shelf_x = shelf_y = shelf_h = 0;
+		}
+
+		layouts.back().push_back({&item, shelf_x + gutter, shelf_y + gutter});
+		shelf_x += w;
+		shelf_h = std::max(shelf_h, h);
+		used_width.back() = std::max(used_width.back(), shelf_x);
+		used_height.back() = std::max(used_height.back(), shelf_y + shelf_h);
+	}
+
+	std::vector<TextureAtlas> atlases(layouts.size());
+	for(unsigned int a = 0; a < layouts.size(); a++){
+		TextureAtlas& atlas = atlases[a];
+		atlas.image.width = used_width[a];
+		atlas.image.height = used_height[a];
+		atlas.image.channels = 4;
+		atlas.gutter = gutter;
+		atlas.image.pixels.reset((unsigned char*)calloc(atlas.image.size(), 1));
+
+		for(Placement p: layouts[a]){
+			const Image& img = *p.item->img;
+			atlas_blit(atlas.image, img, p.x, p.y, gutter);
+			atlas.rects[*p.item->file] = {p.x, p.y, img.width, img.height};
+			if(img.channels == 2 || img.channels == 4)
+				atlas.alpha = true;
+		}
+	}
+	return atlases;
+}
+
+#endif
@@ -0,0 +1,366 @@
+#ifndef TEXTURE_RESIDENCY_H
+#define TEXTURE_RESIDENCY_H
+
+#include <map>
+#include <cmath>
+#include <memory>
+#include <cstring>
+#include "GLutils.h"
+
+////////////////////////////////////////////////////////////////////
+// Keeps in GPU memory only the mip levels a texture needs on screen.
+//
+// Each frame the meshes call request() with the texel density their
+// current screen size requires. Levels finer than the requested one
+// are decoded in background and streamed through a TextureUploader;
+// GL_TEXTURE_BASE_LEVEL always points to the finest resident level.
+// When the resident bytes exceed budget, levels nobody asked for are
+// released first, then the least recently used textures are reduced.
+//
+// A file is decoded once: its finest allowed level is kept in memory
+// (up to decoded_budget bytes) and later loads only downsample it to
+// the level they need.
+class TextureResidency{
+	struct Decoded{
+		std::shared_ptr<const Image> source; // level finest
+		std::vector<Image> chain;            // levels base..levels-1
+	};
+
+	struct StreamedTexture{
+		GLTexture texture;
+		std::string filename;
+		int width = 0;
+		int height = 0;
+		int channels = 0;
+		TextureUsage usage = TextureUsage::Color;
+		int levels = 0;
+		int finest = 0;          // finest level the quality tier allows
+		int resident_base = -1;  // finest resident level, -1 if none
+		int wanted_base = 0;     // finest level requested this frame
+		int loading_base = -1;   // finest level being loaded
+		int pending_uploads = 0;
+		unsigned long last_used = 0;
+		std::shared_ptr<const Image> source;
+		std::future<Decoded> mips;
+
+		int level_width(int l) const{ return std::max(1, width >> l); }
+		int level_height(int l) const{ return std::max(1, height >> l); }
+
+		size_t level_bytes(int l) const{
+			GLenum format = texture_policy.internal_format(channels, usage);
+			return (size_t)level_width(l)*level_height(l)*TexturePolicy::bytes_per_texel(format);
+		}
+
+		size_t bytes() const{
+			size_t b = 0;
+			if(resident_base >= 0)
+				for(int l = resident_base; l < levels; l++)
+					b += level_bytes(l);
+			return b;
+		}
+	};
+
+	std::map<std::string, StreamedTexture> textures;
+	TextureUploader uploader;
+	unsigned long frame = 0;
+
+	public:
+	size_t budget;           // bytes of texture memory
+	size_t decoded_budget = 256 << 20; // bytes of decoded images kept
+	unsigned long generation = 0; // changes when a texture becomes resident
+	int tail_size = 64;      // levels up to this size are always resident
+
+	struct Stats{
+		size_t resident_bytes = 0;
+		size_t evicted_bytes = 0;
+		int loads = 0;
+	}stats;
+
+	TextureResidency(size_t budget = 256 << 20, size_t upload_slot_size = 4 << 20)
+		: uploader{upload_slot_size}, budget{budget}
+	{}
+
+	// Registers a texture and starts loading its coarsest levels.
+	void add(std::string filename, TextureUsage usage = TextureUsage::Color){
+		if(textures.find(filename) != textures.end())
+			return;
+
+		int w, h, n;
+		if(!image_info(filename, w, h, n)){
+			std::cout << "ERROR: could not read texture " << filename << '\n';
+			return;
+		}
+
+		StreamedTexture& t = textures[filename];
+		t.filename = filename;
+		t.width = w;
+		t.height = h;
+		t.channels = n;
+		t.usage = usage;
+		t.levels = mip_levels(w, h);
+
+		// levels above texture_policy.max_size() are never loaded, as
+		// texture_policy.fit() does for textures loaded whole
+		int max = texture_policy.max_size();
+		while(max > 0 && t.finest < t.levels-1 && std::max(t.level_width(t.finest), t.level_height(t.finest)) > max)
+			t.finest++;
+		t.texture = GLTexture{GL_TEXTURE_2D};
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, t.levels-1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, t.levels-1);
+
+		t.wanted_base = tail_level(t);
+		start_loading(t);
+	}
+
+	// GL texture to bind, or 0 while nothing of it is resident.
+	unsigned int get(const std::string& filename) const{
+		auto it = textures.find(filename);
+		if(it == textures.end() || it->second.resident_base < 0)
+			return 0;
+		return it->second.texture;
+	}
+
+	// Asks for enough resolution to map texels_per_uv texels
+	// to one unit of texture coordinates.
+	void request(const std::string& filename, float texels_per_uv){
+		auto it = textures.find(filename);
+		if(it == textures.end())
+			return;
+
+		StreamedTexture& t = it->second;
+		int size = std::max(t.width, t.height);
+		int level = (texels_per_uv <= 0)? t.levels-1:
+			(int)std::floor(std::log2(size/texels_per_uv));
+		level = clamp_level(t, level);
+
+		if(t.last_used != frame){
+			t.last_used = frame;
+			t.wanted_base = level;
+		}else{
+			t.wanted_base = std::min(t.wanted_base, level);
+		}
+	}
+
+	bool idle() const{
+		for(auto& it: textures)
+			if(it.second.loading_base >= 0)
+				return false;
+		return uploader.idle();
+	}
+
+	// Call once per frame, after all requests.
+	void update(){
+		stats.resident_bytes = 0;
+		for(auto& it: textures){
+			StreamedTexture& t = it.second;
+
+			if(t.last_used != frame)
+				t.wanted_base = tail_level(t);
+
+			finish_loading(t);
+
+			// the coarsest levels are always loaded
+			if(t.loading_base < 0 && t.resident_base < 0){
+				t.wanted_base = tail_level(t);
+				start_loading(t);
+			}
+
+			stats.resident_bytes += t.bytes();
+		}
+
+		// bytes that loads in flight will add
+		size_t incoming = 0;
+		for(auto& it: textures){
+			const StreamedTexture& t = it.second;
+			if(t.loading_base >= 0)
+				for(int l = t.loading_base; l < (t.resident_base < 0? t.levels: t.resident_base); l++)
+					incoming += t.level_bytes(l);
+		}
+
+		for(auto& it: textures){
+			StreamedTexture& t = it.second;
+			if(t.loading_base >= 0 || t.resident_base < 0 || t.wanted_base >= t.resident_base)
+				continue;
+
+			// only as many finer levels as the budget allows
+			int base = t.resident_base;
+			size_t extra = 0;
+			while(base > t.wanted_base && 
+			      stats.resident_bytes + incoming + extra + t.level_bytes(base-1) <= budget){
+				base--;
+				extra += t.level_bytes(base);
+			}
+			if(base < t.resident_base){
+				t.wanted_base = base;
+				incoming += extra;
+				start_loading(t);
+			}
+		}
+
+		enforce_budget();
+		enforce_decoded_budget();
+		uploader.update();
+		frame++;
+	}
+
+	private:
+	int tail_level(const StreamedTexture& t) const{
+		int l = 0;
+		while(l < t.levels-1 && std::max(t.level_width(l), t.level_height(l)) > tail_size)
+			l++;
+		return l;
+	}
+
+	int clamp_level(const StreamedTexture& t, int level) const{
+		return std::max(t.finest, std::min(level, tail_level(t)));
+	}
+
+	void start_loading(StreamedTexture& t){
+		int base = std::max(t.wanted_base, t.finest);
+		t.loading_base = base;
+		stats.loads++;
+		int finest = t.finest;
+		t.mips = std::async(std::launch::async, [base, finest](std::string filename, std::shared_ptr<const Image> source){
+			Decoded d;
+			if(!source){
+				Image img = load_image(filename, true);
+				for(int l = 0; img && l < finest; l++)
+					img = downsample(img);
+				if(!img)
+					return d;
+				source = std::make_shared<const Image>(std::move(img));
+			}
+			d.source = source;
+
+			Image img = copy(*source);
+			for(int l = finest; ; l++){
+				bool last = img.width == 1 && img.height == 1;
+				Image next;
+				if(!last)
+					next = downsample(img);
+				if(l >= base)
+					d.chain.push_back(std::move(img));
+				if(last)
+					break;
+				img = std::move(next);
+			}
+			return d;
+		}, t.filename, t.source);
+	}
+
+	static Image copy(const Image& img){
+		Image c;
+		c.width = img.width;
+		c.height = img.height;
+		c.channels = img.channels;
+		c.pixels.reset((unsigned char*)malloc(img.size()));
+		memcpy(c.pixels.get(), img.pixels.get(), img.size());
+		return c;
+	}
+
+	void finish_loading(StreamedTexture& t){
+		if(t.loading_base < 0 || !t.mips.valid() ||
+		   t.mips.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return;
+
+		Decoded d = t.mips.get();
+		std::vector<Image>& chain = d.chain;
+		t.source = d.source;
+		int base = t.loading_base;
+		int end = (t.resident_base < 0)? t.levels: t.resident_base;
+
+		if(chain.empty() || base >= end){
+			t.loading_base = -1;
+			return;
+		}
+
+		for(int l = base; l < end; l++){
+			t.pending_uploads++;
+			StreamedTexture* tp = &t;
+			uploader.upload(t.texture, GL_TEXTURE_2D, l, std::move(chain[l - base]), t.usage,
+				[this, tp, base](unsigned int id){
+					if(--tp->pending_uploads > 0)
+						return;
+					bind_texture(GL_TEXTURE_2D, id);
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, base);
+					if(tp->resident_base < 0)
+						generation++;
+					tp->resident_base = base;
+					tp->loading_base = -1;
+					texture_policy.release(id);
+					texture_policy.account(id, tp->bytes());
+				});
+		}
+	}
+
+	void release_level(StreamedTexture& t){
+		int l = t.resident_base;
+		t.resident_base++;
+
+		bind_texture(GL_TEXTURE_2D, t.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, t.resident_base);
+		// a zero sized image releases the level storage
+		glTexImage2D(GL_TEXTURE_2D, l, texture_policy.internal_format(t.channels, t.usage), 0, 0, 0,
+			pixel_format(t.channels), GL_UNSIGNED_BYTE, NULL);
+		texture_policy.release(t.texture);
+		texture_policy.account(t.texture, t.bytes());
+
+		stats.resident_bytes -= t.level_bytes(l);
+		stats.evicted_bytes += t.level_bytes(l);
+	}
+
+	bool can_release(const StreamedTexture& t) const{
+		return t.loading_base < 0 && t.resident_base >= 0 && t.resident_base < tail_level(t);
+	}
+
+	void enforce_budget(){
+		// first, levels finer than what was requested
+		for(auto& it: textures){
+			StreamedTexture& t = it.second;
+			while(stats.resident_bytes > budget && can_release(t) && t.resident_base < t.wanted_base)
+				release_level(t);
+		}
+
+		// then, least recently used textures
+		while(stats.resident_bytes > budget){
+			StreamedTexture* lru = nullptr;
+			for(auto& it: textures){
+				StreamedTexture& t = it.second;
+				if(can_release(t) && (!lru || t.last_used < lru->last_used ||
+				   (t.last_used == lru->last_used && t.level_bytes(t.resident_base) > lru->level_bytes(lru->resident_base))))
+					lru = &t;
+			}
+			if(lru == nullptr)
+				break;
+			release_level(*lru);
+		}
+	}
+
+	// drops the decoded sources of the least recently used textures
+	void enforce_decoded_budget(){
+		size_t bytes = 0;
+		for(auto& it: textures)
+			if(it.second.source)
+				bytes += it.second.source->size();
+
+		while(bytes > decoded_budget){
+			StreamedTexture* lru = nullptr;
+			for(auto& it: textures){
+				StreamedTexture& t = it.second;
+				if(t.source && t.loading_base < 0 && (!lru || t.last_used < lru->last_used))
+					lru = &t;
+			}
+			if(lru == nullptr)
+				break;
+			bytes -= lru->source->size();
+			lru->source.reset();
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef TRANSFORMS_H
+#define TRANSFORMS_H
+
+#include <vector>
+#include "GLutils.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define TRANSFORMS_SSE
+#include <xmmintrin.h>
+#endif
+
+////////////////////////////////////////////////////////////////////
+// std140 layout of
+//
+//   layout(std140, row_major) uniform ObjectBlock{
+//       mat4 ModelView;
+//       mat4 MVP;
+//       mat3 NormalMatrix;
+//   };
+//
+// row_major lets the matrices be stored as matrix.h keeps them.
+struct ObjectStd140{
+	mat4 ModelView;
+	mat4 MVP;
+	vec4 NormalMatrix[3]; // rows, each padded to a vec4
+};
+static_assert(sizeof(ObjectStd140) == 176, "std140 layout of ObjectBlock");
+
+// C = A*B
+inline void mat4_mul(const mat4& A, const mat4& B, mat4& C){
+#ifdef TRANSFORMS_SSE
+	const float* b = &B.L[0].x;
+	__m128 b0 = _mm_loadu_ps(b);
+	__m128 b1 = _mm_loadu_ps(b+4);
+	__m128 b2 = _mm_loadu_ps(b+8);
+	__m128 b3 = _mm_loadu_ps(b+12);
+	for(int i = 0; i < 4; i++){
+		const float* a = &A.L[i].x;
+		__m128 r = _mm_mul_ps(_mm_set1_ps(a[0]), b0);
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[1]), b1));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[2]), b2));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[3]), b3));
+		_mm_storeu_ps(&C.L[i].x, r);
+	}
+#else
+	C = A*B;
+#endif
+}
+
+// Rows of transpose(inverse(mat3(M))): the cofactors of mat3(M) over its
+// determinant. The fourth component of each row is 0.
+inline void normal_matrix(const mat4& M, vec4 N[3]){
+#ifdef TRANSFORMS_SSE
+	__m128 r0 = _mm_loadu_ps(&M.L[0].x);
+	__m128 r1 = _mm_loadu_ps(&M.L[1].x);
+	__m128 r2 = _mm_loadu_ps(&M.L[2].x);
+
+	// the w lanes cancel out: a.w*b.w - a.w*b.w
+	auto cross = [](__m128 a, __m128 b){
+		__m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+		__m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+		return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+	};
+	__m128 c0 = cross(r1, r2);
+	__m128 c1 = cross(r2, r0);
+	__m128 c2 = cross(r0, r1);
+
+	__m128 d = _mm_mul_ps(r0, c0);
+	d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 3, 0, 1)));
+	d = _mm_add_ss(d, _mm_movehl_ps(d, d));
+	float det = _mm_cvtss_f32(d);
+	__m128 s = _mm_set1_ps(det != 0? 1/det: 1);
+
+	_mm_storeu_ps(&N[0].x, _mm_mul_ps(c0, s));
+	_mm_storeu_ps(&N[1].x, _mm_mul_ps(c1, s));
+	_mm_storeu_ps(&N[2].x, _mm_mul_ps(c2, s));
+#else
+	vec3 r0 = toVec3(M.L[0]), r1 = toVec3(M.L[1]), r2 = toVec3(M.L[2]);
+	vec3 c[3] = {cross(r1, r2), cross(r2, r0), cross(r0, r1)};
+	float det = dot(r0, c[0]);
+	float s = det != 0? 1/det: 1;
+	for(int i = 0; i < 3; i++)
+		N[i] = toVec4(s*c[i], 0);
+#endif
+}
+
+class TransformStage;
+
+// Where a drawable finds its matrices in a TransformStage.
+struct TransformSlot{
+	const TransformStage* stage = nullptr;
+	unsigned int index = 0;
+
+	// Binds the ObjectBlock range of this object.
+	void bind() const;
+
+	// Matrices of the last update(), nullptr without a stage.
+	const ObjectStd140* matrices() const;
+};
+
+////////////////////////////////////////////////////////////////////
+// Computes ModelView, MVP and the normal matrix of every registered
+// object in a single pass and uploads them to one uniform buffer, each
+// object at an offset glBindBufferRange accepts. Shaders read them from
+// ObjectBlock instead of multiplying and inverting matrices per vertex.
+//
+// Each frame: clear(), add() every object, update() with the camera,
+// then draw. update() may be called again with another camera (a mirror)
+// and the slots stay valid.
+class TransformStage{
+	std::vector<mat4> models;
+	std::vector<unsigned char> staging;
+	GLBuffer ubo;
+	unsigned int stride = 0;
+
+	public:
+	void clear(){
+		models.clear();
+	}
+
+	TransformSlot add(const mat4& Model){
+		models.push_back(Model);
+		return {this, (unsigned int)models.size()-1};
+	}
+
+	unsigned int size() const{
+		return models.size();
+	}
+
+	void update(mat4 View, mat4 Projection){
+		if(stride == 0){
+			int alignment;
+			glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+			stride = (sizeof(ObjectStd140) + alignment - 1)/alignment*alignment;
+			ubo = GLBuffer{GL_UNIFORM_BUFFER};
+		}
+		if(models.empty())
+			return;
+
+		mat4 PV;
+		mat4_mul(Projection, View, PV);
+
+		staging.resize(models.size()*stride);
+		for(unsigned int i = 0; i < models.size(); i++){
+			ObjectStd140& o = *(ObjectStd140*)(staging.data() + i*stride);
+			mat4_mul(View, models[i], o.ModelView);
+			mat4_mul(PV, models[i], o.MVP);
+			normal_matrix(o.ModelView, o.NormalMatrix);
+		}
+
+		// a new store each time, so draws of a previous update are not waited for
+		ubo.data(staging, GL_STREAM_DRAW);
+	}
+
+	const ObjectStd140& object(unsigned int index) const{
+		return *(const ObjectStd140*)(staging.data() + index*stride);
+	}
+
+	void bind(unsigned int index) const{
+		static const unsigned int binding = uniform_block_binding("ObjectBlock");
+		bind_buffer_range(GL_UNIFORM_BUFFER, binding, ubo, index*stride, sizeof(ObjectStd140));
+	}
+};
+
+inline void TransformSlot::bind() const{
+	if(stage)
+		stage->bind(index);
+}
+
+inline const ObjectStd140* TransformSlot::matrices() const{
+	return stage? &stage->object(index): nullptr;
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef VERTEX_LAYOUT_H
+#define VERTEX_LAYOUT_H
+
+#include <cstddef>
+#include "GLutils.h"
+#include "ObjMesh.h"
+
+// Attributes 0, 1 and 2 of the bound VAO (position, texCoords and
+// normal) read from a buffer of ObjMesh::Vertex. Every VAO over mesh
+// vertices is set up with it, so the shaders see one vertex format.
+inline void vertex_layout(unsigned int vertex_buffer){
+	using Vertex = ObjMesh::Vertex;
+	size_t stride = sizeof(Vertex);
+
+	bind_buffer(GL_ARRAY_BUFFER, vertex_buffer);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, position));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, texCoords));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, normal));
+}
+
+#endif
@@ -0,0 +1,148 @@
+// Mede a construção, o refit e as consultas da SceneBVH (SceneBVH.h) 
+// com 10 mil a 1 milhão de objetos, e compara as consultas com um teste
+// linear de todos os objetos.
+//
+//   bench_bvh [numero de objetos ...]
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include "SceneBVH.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Melhor tempo (ms) entre várias repetições
+template<class F>
+double best_time(F f, int reps){
+	double best = 1e30;
+	for(int i = 0; i < reps; i++){
+		auto t0 = Clock::now();
+		f();
+		auto t1 = Clock::now();
+		best = std::min(best, std::chrono::duration<double, std::milli>(t1-t0).count());
+	}
+	return best;
+}
+
+bool box_outside(const Frustum& frustum, const AABB& b){
+	for(const vec4& P: frustum.planes){
+		vec3 far = {P.x > 0? b.max.x: b.min.x, P.y > 0? b.max.y: b.min.y, P.z > 0? b.max.z: b.min.z};
+		if(dot(toVec3(P), far) + P.w < 0)
+			return true;
+	}
+	return false;
+}
+
+void bench(int n){
+	// objetos de tamanhos variados espalhados em um cubo cujo volume 
+	// cresce com n, com densidade constante
+	float side = 100*cbrt(n/1000.0);
+	std::mt19937 rng(n);
+	std::uniform_real_distribution<float> pos(-side/2, side/2);
+	std::uniform_real_distribution<float> size(0.5, 4);
+
+	std::vector<AABB> boxes(n);
+	for(AABB& b: boxes){
+		vec3 c = {pos(rng), pos(rng), pos(rng)};
+		vec3 h = {size(rng), size(rng), size(rng)};
+		b.min = c - h;
+		b.max = c + h;
+	}
+
+	SceneBVH bvh;
+	double build_ms = best_time([&]{ bvh.build(boxes); }, 3);
+
+	// 10% dos objetos se movem
+	std::vector<unsigned int> moving;
+	for(int i = 0; i < n; i += 10)
+		moving.push_back(i);
+	float step = 0;
+	double refit_ms = best_time([&]{
+		step += 0.1;
+		vec3 d = {step, 0, 0};
+		for(unsigned int i: moving){
+			AABB b = boxes[i];
+			b.min = b.min + d;
+			b.max = b.max + d;
+			bvh.set_bounds(i, b);
+		}
+		bvh.refit();
+	}, 3);
+	bvh.build(boxes);
+
+	mat4 Projection = scale(1,1,-1)*perspective(45, 16/9.0, 0.1, side);
+	mat4 View = lookAt({0, 0, side/2}, {0, 0, 0}, {0, 1, 0});
+	Frustum frustum{Projection*View};
+
+	std::vector<unsigned int> found, reference;
+	double frustum_ms = best_time([&]{
+		found.clear();
+		bvh.query(frustum, [&](unsigned int i){ found.push_back(i); });
+	}, 10);
+	double frustum_linear_ms = best_time([&]{
+		reference.clear();
+		for(int i = 0; i < n; i++)
+			if(!box_outside(frustum, boxes[i]))
+				reference.push_back(i);
+	}, 10);
+	std::sort(found.begin(), found.end());
+	bool frustum_ok = found == reference;
+
+	// raios do centro em direções aleatórias
+	std::normal_distribution<float> normal;
+	std::vector<vec3> dirs(1000);
+	for(vec3& d: dirs)
+		d = normalize(vec3{normal(rng), normal(rng), normal(rng)});
+
+	std::vector<int> hits(dirs.size()), reference_hits(dirs.size());
+	double ray_ms = best_time([&]{
+		for(size_t r = 0; r < dirs.size(); r++){
+			float t;
+			hits[r] = bvh.raycast({0, 0, 0}, dirs[r], t);
+		}
+	}, 3);
+	double ray_linear_ms = best_time([&]{
+		for(size_t r = 0; r < 20; r++){
+			float best = INFINITY;
+			reference_hits[r] = -1;
+			for(int i = 0; i < n; i++){
+				float t0 = 0, t1 = best;
+				const AABB& b = boxes[i];
+				float o[3] = {0, 0, 0}, d[3] = {dirs[r].x, dirs[r].y, dirs[r].z};
+				float lo3[3] = {b.min.x, b.min.y, b.min.z}, hi3[3] = {b.max.x, b.max.y, b.max.z};
+				for(int a = 0; a < 3; a++){
+					float lo = (lo3[a] - o[a])/d[a], hi = (hi3[a] - o[a])/d[a];
+					if(lo > hi)
+						std::swap(lo, hi);
+					t0 = std::max(t0, lo);
+					t1 = std::min(t1, hi);
+				}
+				if(t0 <= t1 && t0 < best){
+					best = t0;
+					reference_hits[r] = i;
+				}
+			}
+		}
+	}, 1)*dirs.size()/20;
+	bool ray_ok = std::equal(hits.begin(), hits.begin() + 20, reference_hits.begin());
+
+	printf("%8d objects, %7d nodes | build %8.2f ms | refit (10%%) %7.2f ms\n", 
+		n, (int)bvh.nodes.size(), build_ms, refit_ms);
+	printf("         frustum: %6d found %8.3f ms (linear %8.3f ms)%s\n", 
+		(int)found.size(), frustum_ms, frustum_linear_ms, frustum_ok? "": " MISMATCH");
+	printf("         1000 rays:         %8.3f ms (linear %8.3f ms)%s\n", 
+		ray_ms, ray_linear_ms, ray_ok? "": " MISMATCH");
+}
+
+int main(int argc, char* argv[]){
+	std::vector<int> sizes = {10000, 100000, 1000000};
+	if(argc > 1){
+		sizes.clear();
+		for(int i = 1; i < argc; i++)
+			sizes.push_back(atoi(argv[i]));
+	}
+	for(int n: sizes)
+		bench(n);
+}
@@ -0,0 +1,103 @@
+// Mede o tempo do teste de visibilidade de esferas contra o frustum
+// (Culling.h) e compara com o teste escalar, um objeto por vez. Mede
+// também a cópia dos dados de instância dos visíveis (112 bytes cada,
+// como InstanceList::cull em Instancing.h).
+//
+//   bench_cull [numero de objetos]
+//
+// Sem argumentos usa 100000 objetos espalhados em um cubo de 1000 
+// unidades em torno da câmera.
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include "Culling.h"
+
+using Clock = std::chrono::steady_clock;
+
+// mesmo tamanho de InstanceData (Instancing.h)
+struct Instance{
+	float data[28];
+};
+
+// Melhor tempo (ms) entre várias repetições
+template<class F>
+double best_time(F f, int reps){
+	double best = 1e30;
+	for(int i = 0; i < reps; i++){
+		auto t0 = Clock::now();
+		f();
+		auto t1 = Clock::now();
+		best = std::min(best, std::chrono::duration<double, std::milli>(t1-t0).count());
+	}
+	return best;
+}
+
+int main(int argc, char* argv[]){
+	int n = argc > 1? atoi(argv[1]): 100000;
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> pos(-500, 500);
+	std::uniform_real_distribution<float> size(0.5, 10);
+
+	std::vector<vec3> centers(n);
+	std::vector<float> radii(n);
+	SphereCuller culler;
+	for(int i = 0; i < n; i++){
+		centers[i] = {pos(rng), pos(rng), pos(rng)};
+		radii[i] = size(rng);
+		culler.add(centers[i], radii[i]);
+	}
+
+	mat4 Projection = scale(1,1,-1)*perspective(45, 16/9.0, 0.1, 500);
+	mat4 View = lookAt({0, 7, 20}, {10, 5, 0}, {0, 1, 0});
+	Frustum frustum{Projection*View};
+
+	std::vector<unsigned int> visible, reference;
+	const int reps = 50;
+
+	double scalar_ms = best_time([&]{
+		reference.clear();
+		for(int i = 0; i < n; i++)
+			if(frustum.sphere_visible(centers[i], radii[i]))
+				reference.push_back(i);
+	}, reps);
+
+	double batch_ms = best_time([&]{
+		culler.cull(frustum, visible);
+	}, reps);
+
+	if(visible != reference){
+		printf("ERROR: %d visible in batches, %d in the scalar test\n", 
+			(int)visible.size(), (int)reference.size());
+		return 1;
+	}
+
+	std::vector<Instance> instances(n), packed;
+	auto pack = [&](const std::vector<unsigned int>& list){
+		packed.resize(list.size());
+		for(unsigned int k = 0; k < list.size(); k++)
+			packed[k] = instances[list[k]];
+	};
+	double pack_ms = best_time([&]{ pack(visible); }, reps);
+
+	std::vector<unsigned int> all(n);
+	for(int i = 0; i < n; i++)
+		all[i] = i;
+	double pack_all_ms = best_time([&]{ pack(all); }, reps);
+
+#if defined(CULLING_AVX)
+	const char* path = "AVX";
+#elif defined(CULLING_SSE)
+	const char* path = "SSE";
+#else
+	const char* path = "scalar";
+#endif
+	printf("%d objects, %u visible, %u culled\n", n, culler.stats.visible, culler.stats.culled());
+	printf("scalar:      %8.3f ms\n", scalar_ms);
+	printf("batch (%s): %8.3f ms (%.1fx)\n", path, batch_ms, scalar_ms/batch_ms);
+	printf("packing the visible instances: %8.3f ms (%.1f MB)\n", pack_ms, visible.size()*sizeof(Instance)/1048576.0);
+	printf("packing all of them:           %8.3f ms (%.1f MB)\n", pack_all_ms, n*sizeof(Instance)/1048576.0);
+}
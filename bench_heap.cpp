@@ -0,0 +1,62 @@
+// Mede o OffsetAllocator (OffsetAllocator.h) com alocações e liberações
+// aleatórias de malhas de tamanhos variados, como as de um GeometryHeap:
+// tempo por operação, fragmentação antes e depois de compact().
+//
+//   bench_heap [numero de operacoes]
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include "OffsetAllocator.h"
+
+using Clock = std::chrono::steady_clock;
+
+int main(int argc, char* argv[]){
+	int n_ops = argc > 1? atoi(argv[1]): 10000000;
+
+	// 64M vértices; malhas de 100 a 100 mil vértices, a maioria pequenas
+	OffsetAllocator heap{64 << 20};
+	std::mt19937 rng{1};
+	auto mesh_size = [&](){
+		return (uint32_t)(100*std::pow(1000.0, std::uniform_real_distribution<double>{0, 1}(rng)));
+	};
+
+	// enche até ~70% antes de medir
+	std::vector<OffsetAllocator::Allocation> live;
+	while(heap.report().used < heap.capacity()/10*7)
+		live.push_back(heap.allocate(mesh_size()));
+
+	std::vector<uint32_t> sizes(n_ops);
+	std::vector<uint32_t> picks(n_ops);
+	for(int i = 0; i < n_ops; i++){
+		sizes[i] = mesh_size();
+		picks[i] = rng();
+	}
+
+	int failed = 0;
+	auto t0 = Clock::now();
+	for(int i = 0; i < n_ops; i++){
+		// libera uma malha qualquer e carrega outra
+		uint32_t k = picks[i] % live.size();
+		heap.free(live[k]);
+		live[k] = heap.allocate(sizes[i]);
+		if(!live[k])
+			failed++;
+	}
+	auto t1 = Clock::now();
+	double ns = std::chrono::duration<double, std::nano>(t1-t0).count()/(2.0*n_ops);
+
+	OffsetAllocator::Report before = heap.report();
+	t0 = Clock::now();
+	heap.compact([](uint32_t, uint32_t, uint32_t){});
+	t1 = Clock::now();
+	OffsetAllocator::Report after = heap.report();
+
+	printf("%d alloc/free pairs: %.1f ns per operation, %d allocations failed\n", n_ops, ns, failed);
+	printf("%u meshes, %.1f%% used\n", before.allocations, 100.0*before.used/before.size);
+	printf("before compact: %u free ranges, fragmentation %.3f\n", before.free_blocks, before.fragmentation());
+	printf("after compact:  %u free ranges, fragmentation %.3f (%.2f ms)\n", after.free_blocks, after.fragmentation(),
+		std::chrono::duration<double, std::milli>(t1-t0).count());
+}
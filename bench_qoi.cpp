@@ -0,0 +1,128 @@
+// Compara o tempo de decodificação e o tamanho dos arquivos PNG 
+// (stb_image) com os mesmos dados codificados em QOI.
+//
+//   bench_qoi [diretorio|arquivo.png ...]
+//
+// Sem argumentos percorre todos os PNG a partir do diretório atual.
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "QOI.h"
+
+using Clock = std::chrono::steady_clock;
+
+bool is_png(std::string name){
+	std::string ext = name.size() > 4? name.substr(name.size()-4): "";
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	return ext == ".png";
+}
+
+void find_png(std::string path, std::vector<std::string>& files){
+	struct stat st;
+	if(stat(path.c_str(), &st) != 0)
+		return;
+
+	if(!S_ISDIR(st.st_mode)){
+		if(is_png(path))
+			files.push_back(path);
+		return;
+	}
+
+	DIR* dir = opendir(path.c_str());
+	if(dir == NULL)
+		return;
+	while(dirent* e = readdir(dir)){
+		std::string name = e->d_name;
+		if(name == "." || name == ".." || name == ".git")
+			continue;
+		find_png(path + "/" + name, files);
+	}
+	closedir(dir);
+}
+
+// Melhor tempo (ms) entre várias repetições
+template<class F>
+double best_time(F f, int reps){
+	double best = 1e30;
+	for(int i = 0; i < reps; i++){
+		auto t0 = Clock::now();
+		f();
+		auto t1 = Clock::now();
+		best = std::min(best, std::chrono::duration<double, std::milli>(t1-t0).count());
+	}
+	return best;
+}
+
+int main(int argc, char* argv[]){
+	std::vector<std::string> files;
+	if(argc < 2)
+		find_png(".", files);
+	for(int i = 1; i < argc; i++)
+		find_png(argv[i], files);
+	std::sort(files.begin(), files.end());
+
+	const int reps = 5;
+	double total_png_ms = 0, total_qoi_ms = 0;
+	size_t total_png_size = 0, total_qoi_size = 0;
+
+	printf("%-50s %11s %9s %9s %9s %9s %7s\n", 
+		"file", "size", "png(KB)", "qoi(KB)", "png(ms)", "qoi(ms)", "speedup");
+
+	for(std::string file: files){
+		std::vector<unsigned char> png = qoi_read_file(file);
+
+		int w, h, n;
+		if(!stbi_info_from_memory(png.data(), png.size(), &w, &h, &n))
+			continue;
+		int channels = (n == 2 || n == 4)? 4: 3;
+
+		unsigned char* pixels = stbi_load_from_memory(png.data(), png.size(), &w, &h, &n, channels);
+		if(pixels == NULL)
+			continue;
+
+		QOIDesc desc;
+		desc.width = w;
+		desc.height = h;
+		desc.channels = channels;
+		std::vector<unsigned char> qoi = qoi_encode(pixels, desc);
+
+		std::vector<unsigned char> decoded((size_t)w*h*channels);
+		bool ok = qoi_decode_into(qoi.data(), qoi.size(), decoded.data(), channels) &&
+			memcmp(decoded.data(), pixels, decoded.size()) == 0;
+		stbi_image_free(pixels);
+		if(!ok){
+			printf("%-50s ERROR: QOI round trip mismatch\n", file.c_str());
+			continue;
+		}
+
+		double png_ms = best_time([&]{
+			stbi_image_free(stbi_load_from_memory(png.data(), png.size(), &w, &h, &n, channels));
+		}, reps);
+
+		double qoi_ms = best_time([&]{
+			qoi_decode_into(qoi.data(), qoi.size(), decoded.data(), channels);
+		}, reps);
+
+		total_png_ms += png_ms;
+		total_qoi_ms += qoi_ms;
+		total_png_size += png.size();
+		total_qoi_size += qoi.size();
+
+		char dims[32];
+		snprintf(dims, sizeof dims, "%dx%dx%d", w, h, channels);
+		printf("%-50.50s %11s %9.1f %9.1f %9.2f %9.2f %6.1fx\n", file.c_str(), dims,
+			png.size()/1024.0, qoi.size()/1024.0, png_ms, qoi_ms, png_ms/qoi_ms);
+	}
+
+	if(total_qoi_ms > 0)
+		printf("%-50s %11s %9.1f %9.1f %9.2f %9.2f %6.1fx\n", "TOTAL", "",
+			total_png_size/1024.0, total_qoi_size/1024.0, 
+			total_png_ms, total_qoi_ms, total_png_ms/total_qoi_ms);
+}
@@ -1,165 +1,9 @@
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include "GLutils.h"
-#include "ObjMesh.h"
-
-using Vertex = ObjMesh::Vertex;
-
-GLTexture init_texture(std::string image){
-	GLTexture texture{GL_TEXTURE_2D};
-	texture.load(image);
-
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	if(GLEW_EXT_texture_filter_anisotropic){
-		GLfloat fLargest;
-		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &fLargest);
-		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, fLargest);
-	}
-	return texture;
-}
-
-MaterialInfo standard_material(std::string mat_Kd){
-	MaterialInfo mat;
-
-	mat.name = "standard";
-
-	mat.Ka = {1, 1, 1};
-	mat.Kd = {1, 1, 1};
-	mat.Ks = {0, 0, 0};
-	mat.Ns = 1;
-
-	mat.map_Kd = mat_Kd;
-
-	return mat;
-}
-
-struct SurfaceMesh{
-	std::vector<Vertex> vertices;
-	std::vector<unsigned int> indices;
-};
-
-class GLMesh{
-	VAO vao;
-	GLBuffer vbo;
-	GLBuffer ebo;
-	std::vector<MaterialRange> materials;
-	std::map<std::string, GLTexture> texture_map;
-	public:
-	mat4 Model;
-
-	GLMesh() = default;
-
-	GLMesh(std::string obj_file, mat4 _Model, MaterialInfo std_mat=standard_material("")){
-		ObjMesh mesh{obj_file};
-		std::vector<Vertex> tris = mesh.getTriangles();
-		init_buffers(tris);
-
-		materials = mesh.getMaterials(std_mat);
-
-		for(MaterialRange range: materials){
-			load_texture(mesh.path, range.mat.map_Ka);
-			load_texture(mesh.path, range.mat.map_Kd);
-			load_texture(mesh.path, range.mat.map_Ks);
-			load_texture(mesh.path, range.mat.map_Bump);
-		}
-		
-		Model = _Model;
-	}
-	
-	GLMesh(const SurfaceMesh& surface, mat4 _Model, MaterialInfo std_mat = standard_material("")){
-		Model = _Model;
-		init_buffers(surface.vertices);
-
-		ebo = GLBuffer{GL_ELEMENT_ARRAY_BUFFER};
-		ebo.data(surface.indices, GL_STATIC_DRAW);
-
-		unsigned int size = surface.indices.size();
-
-		materials = {
-			{std_mat, 0, size}
-		};
-		load_texture("", std_mat.map_Kd);
-	}
-
-	void init_buffers(const std::vector<Vertex>& vertices){
-		vao = VAO{true};
-		glBindVertexArray(vao);
-
-		vbo = GLBuffer{GL_ARRAY_BUFFER};
-		vbo.data(vertices, GL_STATIC_DRAW);
-
-		size_t stride = sizeof(Vertex);
-		size_t offset_position = offsetof(Vertex, position);
-		size_t offset_texCoords = offsetof(Vertex, texCoords);
-		size_t offset_normal = offsetof(Vertex, normal);
-
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offset_position);
-
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride,(void*)offset_texCoords);
-
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride,(void*)offset_normal);
-	}
-	
-	void load_texture(std::string path, std::string file){
-		if(file != "" && texture_map.find(file) == texture_map.end()){
-			std::string img = path + file;
-			std::cout << "read image " << img << '\n';
-			texture_map[file] = init_texture(img);
-		}
-	}
-
-	void draw(MaterialRange range) const{
-		Uniform{"Ka"} = range.mat.Ka; 
-		Uniform{"Kd"} = range.mat.Kd;
-		Uniform{"Ks"} = range.mat.Ks;
-		Uniform{"shininess"} = range.mat.Ns;
-
-		bool has_map_Ka = texture_map.find(range.mat.map_Ka) != texture_map.end();
-		Uniform{"has_map_Ka"} = has_map_Ka;
-		if(has_map_Ka){
-			Uniform{"map_Ka"} = 0;
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, texture_map.at(range.mat.map_Ka));
-		}
-
-		bool has_map_Kd = texture_map.find(range.mat.map_Kd) != texture_map.end();
-		Uniform{"has_map_Kd"} = has_map_Kd;
-		if(has_map_Kd){
-			Uniform{"map_Kd"} = 1;
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, texture_map.at(range.mat.map_Kd));
-		}
-
-		bool has_map_Ks = texture_map.find(range.mat.map_Ks) != texture_map.end();
-		Uniform{"has_map_Ks"} = has_map_Ks;
-		if(has_map_Ks){
-			Uniform{"map_Ks"} = 2;
-			glActiveTexture(GL_TEXTURE2);
-			glBindTexture(GL_TEXTURE_2D, texture_map.at(range.mat.map_Ks));
-		}
-
-		glBindVertexArray(vao);
-		if(ebo == 0)
-			glDrawArrays(GL_TRIANGLES, range.first, range.count);
-		else
-			glDrawElements(GL_TRIANGLES, range.count, GL_UNSIGNED_INT, (void*)(range.first*sizeof(int)));
-	}
-
-	void draw() const{
-		Uniform{"Model"} = Model;
-		for(MaterialRange range: materials)
-			draw(range);
-	}
-};
+#include "GLMesh.h"
+#include "Lights.h"
+#include "StaticWorld.h"
 
 SurfaceMesh flag_mesh(int m, int n){
 	int N = m*n;
@@ -201,8 +45,23 @@ SurfaceMesh flag_mesh(int m, int n){
 	return res;
 }
 
-ShaderProgram shaderProgram;
+ShaderPermutations* permutations = nullptr;
+ShaderPermutations* array_permutations = nullptr; // PhongTexLightsArray.frag
+TextureArrays texture_arrays;
+bool use_atlas = false;
+bool use_arrays = false;
+TransformStage transforms;
+SphereCuller culler;
+OcclusionCuller occlusion;
+OcclusionQueries occlusion_queries;
+RenderQueue render_queue;
+bool sorted_draws = true;
+StaticWorld* world = nullptr;
+bool use_world = false;
+std::vector<unsigned int> visible;
 std::vector<GLMesh> meshes;
+TextureResidency* residency = nullptr;
+LightBlock light_block;
 float angle = 0;
 	
 vec3 L0 = {0.4, 0.4, 0.7};
@@ -210,102 +69,200 @@ vec3 L1 = {0.6, 0.6, 0.0};
 vec3 L2 = {0.3, 0.3, 0.3};
 	
 void init_scene(){
+	GLMeshOptions options;
+	options.permutations = permutations;
+	options.queries = &occlusion_queries;
+	options.atlas = use_atlas;
+
+	GLMeshOptions streamed = options;
+	streamed.residency = residency;
+
+	// a queue draws with one set of variants, so nothing is streamed
+	// when the textures are in arrays
+	if(use_arrays){
+		options.permutations = array_permutations;
+		options.arrays = &texture_arrays;
+		streamed = options;
+	}
+
+	GLMeshOptions occluder = options;
+	occluder.occluder = true;
+
 	meshes.emplace_back(
 		flag_mesh(50, 50), 
 		translate(0, 8, -10)*scale(1.4282, 1, 1), 
-		standard_material("brasil.png")
+		standard_material("brasil.png"),
+		options
 	);
 
 	meshes.emplace_back(
 		"modelos/bunny.obj", 
 		translate(0, 5.2, 2), 
-		standard_material("../blue.png")
+		standard_material("../blue.png"),
+		options
 	); 
 
 	meshes.emplace_back(
 		"modelos/monkey.obj", 
-		translate(0, 5.6, -2)*scale(1.4, 1.4, 1.4)*rotate_x(-0.7)
+		translate(0, 5.6, -2)*scale(1.4, 1.4, 1.4)*rotate_x(-0.7),
+		standard_material(""),
+		options
 	);
 
 	meshes.emplace_back(
 		"modelos/teapot.obj", 
 		translate(6,0,4)*scale(.14,.14,.14)*rotate_x(-M_PI/2), 
-		standard_material("../bob.jpg")
+		standard_material("../bob.jpg"),
+		options
 	);
 
 	meshes.emplace_back(
 		"modelos/wall.obj", 
 		scale(20, 20, 20), 
-		standard_material("../brickwall.jpg")
+		standard_material("../brickwall.jpg"),
+		occluder
 	);
 
 	meshes.emplace_back(
 		"modelos/Wood Table/Old Wood Table.obj", 
-		translate(0,1.08,0)
+		translate(0,1.08,0),
+		standard_material(""),
+		options
 	);
 
 	meshes.emplace_back(
 		"modelos/pose/pose.obj", 
-		translate(-6, 0, 4)*rotate_y(1)*scale(.05, .05, .05)
+		translate(-6, 0, 4)*rotate_y(1)*scale(.05, .05, .05),
+		standard_material(""),
+		streamed
 	);
 
 	meshes.emplace_back(
 		"modelos/train-toy-cartoon/train-toy-cartoon.obj", 
-		translate(0,0,6)*rotate_y(-2.3)*scale(120, 120, 120)
+		translate(0,0,6)*rotate_y(-2.3)*scale(120, 120, 120),
+		standard_material(""),
+		streamed
 	);
 }
 
 void init_shader(){
-	shaderProgram = ShaderProgram{
-		Shader{"PhongShaderTex.vert", GL_VERTEX_SHADER},
-		Shader{"PhongTexLights.frag", GL_FRAGMENT_SHADER}
-	};
-	glUseProgram(shaderProgram);
-
+	permutations = new ShaderPermutations{"PhongShaderTex.vert", "PhongTexLights.frag"};
+	array_permutations = new ShaderPermutations{"PhongShaderTex.vert", "PhongTexLightsArray.frag"};
+	light_block = LightBlock{true};
 }
 
 void init(){
 	glewInit();
-	glEnable(GL_DEPTH_TEST);
+	enable(GL_DEPTH_TEST);
 
-	init_scene();
 	init_shader();
+	residency = new TextureResidency{128 << 20};
+	init_scene();
+
+	// nothing in this scene moves
+	world = new StaticWorld{"PhongTexLights.frag"};
+	world->build(meshes);
+}
+
+// Loads the meshes again after 'a' or 't' changed how textures are stored.
+void reload_scene(){
+	meshes.clear();
+	init_scene();
+
+	// the static world binds 2D textures
+	if(use_arrays)
+		use_world = false;
+	else
+		world->build(meshes);
+	glutPostRedisplay();
 }
 
 void desenha(){
 	glClearColor(1, 1, 1, 1);	
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	
-	glUseProgram(shaderProgram);
-	
-	Uniform{"lights[0].position"} = vec4{ 6.0, 7.0, 5.0, 1.0 };
-	Uniform{"lights[0].Ia"} =  0.2*L0;
-	Uniform{"lights[0].Id"} =  L0;
-	Uniform{"lights[0].Is"} = L0;
-
-	Uniform{"lights[1].position"} = vec4{ -6.0, 7.0, 7.0, 1.0 };
-	Uniform{"lights[1].Ia"} =  0.2*L1;
-	Uniform{"lights[1].Id"} =  L1;
-	Uniform{"lights[1].Is"} = L1;
-	
-	Uniform{"lights[2].position"} = vec4{ 0.0, 7.0, 0.0, 1.0 };
-	Uniform{"lights[2].Ia"} =  0.2*L2;
-	Uniform{"lights[2].Id"} =  L2;
-	Uniform{"lights[2].Is"} = L2;
-	
-	Uniform{"n_lights"} = 3;
-
 	int w = glutGet(GLUT_WINDOW_WIDTH);
 	int h = glutGet(GLUT_WINDOW_HEIGHT);
 	float a = w/(float)h;
-	Uniform{"Projection"} = scale(1,1,-1)*perspective(45, a, 0.1, 50);
+	mat4 Projection = scale(1,1,-1)*perspective(45, a, 0.1, 50);
 	vec4 pos = rotate_y(angle)*vec4{0, 8, 20, 1};
-	Uniform{"View"} = lookAt(toVec3(pos), {0, 4, 0}, {0, 1, 0});
+	mat4 View = lookAt(toVec3(pos), {0, 4, 0}, {0, 1, 0});
 
-	for(GLMesh& m: meshes)
-		m.draw();
+	for(const GLMesh& m: meshes)
+		if(m.is_occluder())
+			occlusion.add_occluder(m.occluder_triangles(), m.Model);
+	occlusion.begin(View, Projection);
+
+	std::vector<Light> lights = {
+		{{ 6.0, 7.0, 5.0, 1.0}, 0.2*L0, L0, L0},
+		{{-6.0, 7.0, 7.0, 1.0}, 0.2*L1, L1, L1},
+		{{ 0.0, 7.0, 0.0, 1.0}, 0.2*L2, L2, L2}
+	};
+	light_block.update(lights, View);
+	permutations->set_lights(lights.size());
+	array_permutations->set_lights(lights.size());
+	world->permutations.set_lights(lights.size());
+
+	culler.clear();
+	for(GLMesh& m: meshes){
+		vec3 center;
+		float radius;
+		m.bounding_sphere(center, radius);
+		culler.add(center, radius);
+	}
+	culler.cull(Frustum{Projection*View}, visible);
+
+	// the occluders are rasterized while the frustum is tested
+	occlusion.finish();
+	visible.erase(std::remove_if(visible.begin(), visible.end(), [](unsigned int i){
+		const GLMesh& m = meshes[i];
+		return !m.is_occluder() && !occlusion.visible(m.Model, m.bbox_min, m.bbox_max);
+	}), visible.end());
+
+	for(unsigned int i: visible)
+		meshes[i].request_texture_levels(View, Projection, h);
+	residency->update();
+
+	transforms.clear();
+	for(unsigned int i: visible)
+		meshes[i].transform = transforms.add(meshes[i].Model);
+	transforms.update(View, Projection);
+
+	if(use_world){
+		world->draw(View, Projection, visible);
+	}else if(sorted_draws){
+		render_queue.clear();
+		for(unsigned int i: visible)
+			meshes[i].enqueue(render_queue, View);
+		render_queue.sort();
+		GLMesh::draw(render_queue);
+	}else{
+		for(unsigned int i: visible)
+			meshes[i].draw();
+	}
+
+	static unsigned int drawn = ~0u;
+	if(visible.size() != drawn){
+		drawn = visible.size();
+		printf("Meshes: %u drawn, %u outside the frustum, %u occluded\n", 
+			drawn, culler.stats.culled(), occlusion.stats.occluded);
+	}
+
+	static size_t texture_bytes = 0;
+	if(texture_policy.used != texture_bytes){
+		texture_bytes = texture_policy.used;
+		printf("Texture memory: %.1f MB\n", texture_bytes/(1024.0*1024.0));
+	}
 
 	glutSwapBuffers();
+	gl_state.new_frame();
+	occlusion_queries.new_frame();
+}
+
+void idle(){
+	// keep drawing while textures are streamed in
+	if(!residency->idle())
+		glutPostRedisplay();
 }
 
 int last_x;
@@ -348,6 +305,49 @@ void special(int key, int x, int y){
 	glutPostRedisplay();
 }
 
+void keyboard(unsigned char key, int x, int y){
+	if(key == 's'){
+		printf("GL state calls: %d issued, %d elided (%s)\n", 
+			gl_state.last_frame.issued, gl_state.last_frame.elided,
+			use_world? "static world": sorted_draws? "render queue": "mesh order");
+		if(use_world)
+			printf("Static world: %d meshes, %d material ranges in %d buckets, %d draw calls\n",
+				world->stats.objects, world->stats.draws, world->stats.buckets, world->stats.calls);
+		printf("Shader variants: %d\n", permutations->size());
+		printf("Occlusion queries: %d issued, %d draws skipped\n",
+			occlusion_queries.last_frame.issued, occlusion_queries.last_frame.skipped);
+	}
+	if(key == 'w' && !use_arrays){
+		use_world = !use_world;
+		printf("Static world: %s\n", use_world? "on": "off");
+		glutPostRedisplay();
+	}
+	if(key == 'a'){
+		use_atlas = !use_atlas;
+		printf("Texture atlases: %s\n", use_atlas? "on": "off");
+		reload_scene();
+	}
+
+	if(key == 't'){
+		use_arrays = !use_arrays;
+		printf("Texture arrays: %s\n", use_arrays? "on": "off");
+		reload_scene();
+	}
+
+	if(key == 'q'){
+		sorted_draws = !sorted_draws;
+		printf("Draw order: %s\n", sorted_draws? "render queue": "mesh order");
+		glutPostRedisplay();
+	}
+}
+
+// Tecla 's': chamadas de mudança de estado do último quadro, variantes do shader
+// e consultas de oclusão.
+// Tecla 'q': alterna entre a fila de desenho ordenada e a ordem das malhas.
+// Tecla 'w': desenha a cena estática com glMultiDrawElementsIndirect.
+// Tecla 'a': recarrega a cena com os mapas difusos pequenos em atlas.
+// Tecla 't': recarrega a cena com as texturas em arrays de texturas
+// (PhongTexLightsArray.frag); os atlas não são usados com eles.
 int main(int argc, char* argv[]){
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_MULTISAMPLE | GLUT_DEPTH);
@@ -360,6 +360,8 @@ int main(int argc, char* argv[]){
 	glutMouseFunc(mouse);
 	glutMotionFunc(mouseMotion);
 	glutSpecialFunc(special);
+	glutKeyboardFunc(keyboard);
+	glutIdleFunc(idle);
 	
 	printf("GL Version: %s\n", glGetString(GL_VERSION));
 	printf("GLSL Version: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
@@ -1,165 +1,7 @@
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include "GLutils.h"
-#include "ObjMesh.h"
-
-using Vertex = ObjMesh::Vertex;
-
-GLTexture init_texture(std::string image){
-	GLTexture texture{GL_TEXTURE_2D};
-	texture.load(image);
-
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	if(GLEW_EXT_texture_filter_anisotropic){
-		GLfloat fLargest;
-		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &fLargest);
-		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, fLargest);
-	}
-	return texture;
-}
-
-MaterialInfo standard_material(std::string mat_Kd){
-	MaterialInfo mat;
-
-	mat.name = "standard";
-
-	mat.Ka = {1, 1, 1};
-	mat.Kd = {1, 1, 1};
-	mat.Ks = {0, 0, 0};
-	mat.Ns = 1;
-
-	mat.map_Kd = mat_Kd;
-
-	return mat;
-}
-
-struct SurfaceMesh{
-	std::vector<Vertex> vertices;
-	std::vector<unsigned int> indices;
-};
-
-class GLMesh{
-	VAO vao;
-	GLBuffer vbo;
-	GLBuffer ebo;
-	std::vector<MaterialRange> materials;
-	std::map<std::string, GLTexture> texture_map;
-	public:
-	mat4 Model;
-
-	GLMesh() = default;
-
-	GLMesh(std::string obj_file, mat4 _Model, MaterialInfo std_mat=standard_material("")){
-		ObjMesh mesh{obj_file};
-		std::vector<Vertex> tris = mesh.getTriangles();
-		init_buffers(tris);
-
-		materials = mesh.getMaterials(std_mat);
-
-		for(MaterialRange range: materials){
-			load_texture(mesh.path, range.mat.map_Ka);
-			load_texture(mesh.path, range.mat.map_Kd);
-			load_texture(mesh.path, range.mat.map_Ks);
-			load_texture(mesh.path, range.mat.map_Bump);
-		}
-		
-		Model = _Model;
-	}
-	
-	GLMesh(const SurfaceMesh& surface, mat4 _Model, MaterialInfo std_mat = standard_material("")){
-		Model = _Model;
-		init_buffers(surface.vertices);
-
-		ebo = GLBuffer{GL_ELEMENT_ARRAY_BUFFER};
-		ebo.data(surface.indices, GL_STATIC_DRAW);
-
-		unsigned int size = surface.indices.size();
-
-		materials = {
-			{std_mat, 0, size}
-		};
-		load_texture("", std_mat.map_Kd);
-	}
-
-	void init_buffers(const std::vector<Vertex>& vertices){
-		vao = VAO{true};
-		glBindVertexArray(vao);
-
-		vbo = GLBuffer{GL_ARRAY_BUFFER};
-		vbo.data(vertices, GL_STATIC_DRAW);
-
-		size_t stride = sizeof(Vertex);
-		size_t offset_position = offsetof(Vertex, position);
-		size_t offset_texCoords = offsetof(Vertex, texCoords);
-		size_t offset_normal = offsetof(Vertex, normal);
-
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offset_position);
-
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride,(void*)offset_texCoords);
-
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride,(void*)offset_normal);
-	}
-	
-	void load_texture(std::string path, std::string file){
-		if(file != "" && texture_map.find(file) == texture_map.end()){
-			std::string img = path + file;
-			std::cout << "read image " << img << '\n';
-			texture_map[file] = init_texture(img);
-		}
-	}
-
-	void draw(MaterialRange range) const{
-		Uniform{"Ka"} = range.mat.Ka; 
-		Uniform{"Kd"} = range.mat.Kd;
-		Uniform{"Ks"} = range.mat.Ks;
-		Uniform{"shininess"} = range.mat.Ns;
-
-		bool has_map_Ka = texture_map.find(range.mat.map_Ka) != texture_map.end();
-		Uniform{"has_map_Ka"} = has_map_Ka;
-		if(has_map_Ka){
-			Uniform{"map_Ka"} = 0;
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, texture_map.at(range.mat.map_Ka));
-		}
-
-		bool has_map_Kd = texture_map.find(range.mat.map_Kd) != texture_map.end();
-		Uniform{"has_map_Kd"} = has_map_Kd;
-		if(has_map_Kd){
-			Uniform{"map_Kd"} = 1;
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, texture_map.at(range.mat.map_Kd));
-		}
-
-		bool has_map_Ks = texture_map.find(range.mat.map_Ks) != texture_map.end();
-		Uniform{"has_map_Ks"} = has_map_Ks;
-		if(has_map_Ks){
-			Uniform{"map_Ks"} = 2;
-			glActiveTexture(GL_TEXTURE2);
-			glBindTexture(GL_TEXTURE_2D, texture_map.at(range.mat.map_Ks));
-		}
-
-		glBindVertexArray(vao);
-		if(ebo == 0)
-			glDrawArrays(GL_TRIANGLES, range.first, range.count);
-		else
-			glDrawElements(GL_TRIANGLES, range.count, GL_UNSIGNED_INT, (void*)(range.first*sizeof(int)));
-	}
-
-	void draw() const{
-		Uniform{"Model"} = Model;
-		for(MaterialRange range: materials)
-			draw(range);
-	}
-};
+#include "GLMesh.h"
 
 SurfaceMesh flag_mesh(int m, int n){
 	int N = m*n;
@@ -204,9 +46,11 @@ SurfaceMesh flag_mesh(int m, int n){
 std::vector<GLMesh> meshes;
 GLMesh mirror;
 ShaderProgram shaderProgram;
+TransformStage transforms;
 
 float angle = 0;
 mat4 View;
+mat4 Projection;
 	
 void init_scene(){
 	mirror = { "modelos/wall.obj", 
@@ -262,14 +106,14 @@ void init_shader(){
 		Shader{"PhongShaderTex.vert", GL_VERTEX_SHADER},
 		Shader{"PhongShaderTex.frag", GL_FRAGMENT_SHADER}
 	};
-	glUseProgram(shaderProgram);
+	use_program(shaderProgram);
 
 }
 
 void init(){
 	glewInit();
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_STENCIL_TEST);
+	enable(GL_DEPTH_TEST);
+	enable(GL_STENCIL_TEST);
 
 	init_scene();
 
@@ -280,10 +124,16 @@ void setup_matrices(){
 	int w = glutGet(GLUT_WINDOW_WIDTH);
 	int h = glutGet(GLUT_WINDOW_HEIGHT);
 	float a = w/(float)h;
-	Uniform{"Projection"} = scale(1,1,-1)*perspective(45, a, 0.1, 50);
+	Projection = scale(1,1,-1)*perspective(45, a, 0.1, 50);
 
 	vec4 pos = rotate_y(angle)*vec4{20, 8, 20, 1};
 	Uniform{"View"} = View = lookAt(toVec3(pos), {0, 4, 0}, {0, 1, 0});
+
+	transforms.clear();
+	mirror.transform = transforms.add(mirror.Model);
+	for(GLMesh& m: meshes)
+		m.transform = transforms.add(m.Model);
+	transforms.update(View, Projection);
 }
 	
 void setup_light(float scale){
@@ -294,35 +144,36 @@ void setup_light(float scale){
 }
 
 void draw_mirror(){
-	glEnable(GL_STENCIL_TEST);
+	enable(GL_STENCIL_TEST);
 
-	glStencilMask(0xFF);
+	stencil_mask(0xFF);
 	glClear(GL_STENCIL_BUFFER_BIT);
 
-	glDepthMask(GL_FALSE);
+	depth_mask(false);
 
-	glStencilFunc(GL_ALWAYS, 1, 0xFF);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+	stencil_func(GL_ALWAYS, 1, 0xFF);
+	stencil_op(GL_KEEP, GL_KEEP, GL_REPLACE);
 
 	mirror.draw();
 
 	Uniform{"View"} = View*scale(1, -1, 1);
+	transforms.update(View*scale(1, -1, 1), Projection);
 
-	glStencilFunc(GL_EQUAL, 1, 0xFF);
-	glDepthMask(GL_TRUE);
-	glStencilMask(0x00);
+	stencil_func(GL_EQUAL, 1, 0xFF);
+	depth_mask(true);
+	stencil_mask(0x00);
 	
 	setup_light(0.3);
 	draw_scene();
 
-	glDisable(GL_STENCIL_TEST);
+	disable(GL_STENCIL_TEST);
 }
 
 void desenha(){
 	glClearColor(1, 1, 1, 1);	
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	
-	glUseProgram(shaderProgram);
+	use_program(shaderProgram);
 	setup_matrices();
 
 	setup_light(1);
@@ -11,7 +11,7 @@ void init_shaders(){
 		Shader{"SimpleShader.vert", GL_VERTEX_SHADER},
 		Shader{"SimpleShader.frag", GL_FRAGMENT_SHADER}
 	};
-	glUseProgram(shaderProgram);
+	use_program(shaderProgram);
 }
 
 void init_buffers(){
@@ -31,7 +31,7 @@ void init_buffers(){
 	};
 
 	vao = VAO{true};
-	glBindVertexArray(vao);
+	bind_vertex_array(vao);
 
 	vbo = GLBuffer{GL_ARRAY_BUFFER};
 	vbo.data(V, GL_STATIC_DRAW);
@@ -68,7 +68,7 @@ void desenha(){
 
 	setup_uniforms();
 
-	glBindVertexArray(vao);
+	bind_vertex_array(vao);
 	glDrawElements(GL_LINES, 24, GL_UNSIGNED_INT, 0);
 
 	glutSwapBuffers();
@@ -16,7 +16,7 @@ void init_shader(){
 		Shader{"TextureShader.vert", GL_VERTEX_SHADER},
 		Shader{"TextureShader.frag", GL_FRAGMENT_SHADER}
 	};
-	glUseProgram(shaderProgram);
+	use_program(shaderProgram);
 }
 
 void init_texture(std::string image){
@@ -42,7 +42,7 @@ void init_surface(){
 	auto mesh_triangles = mesh.getTriangles();
 	
 	vao = VAO{true};
-	glBindVertexArray(vao);
+	bind_vertex_array(vao);
 
 	vbo = GLBuffer{GL_ARRAY_BUFFER};
 	vbo.data(mesh_triangles, GL_STATIC_DRAW);
@@ -62,7 +62,7 @@ void init_surface(){
 
 void init(){
 	glewInit();
-	glEnable(GL_DEPTH_TEST);
+	enable(GL_DEPTH_TEST);
 	
 	init_shader();
 	init_surface();
@@ -82,7 +82,7 @@ void desenha(){
 
 	Uniform{"M"} = Projection*View*Model;
 
-	glBindVertexArray(vao);
+	bind_vertex_array(vao);
 	glDrawArrays(GL_TRIANGLES, 0, n_verts);
 
 	glutSwapBuffers();
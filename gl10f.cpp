@@ -52,7 +52,7 @@ class GLMesh{
 	}
 
 	void draw() const{
-		glBindVertexArray(vao);
+		bind_vertex_array(vao);
 		for(MaterialRange range: materials){
 			get_texture(range.mat.map_Kd);
 			glDrawArrays(GL_TRIANGLES, range.first, range.count);
@@ -62,7 +62,7 @@ class GLMesh{
 	private:
 	void init_buffers(const std::vector<Vertex>& vertices){
 		vao = VAO{true};
-		glBindVertexArray(vao);
+		bind_vertex_array(vao);
 
 		vbo = GLBuffer{GL_ARRAY_BUFFER};
 		vbo.data(vertices, GL_STATIC_DRAW);
@@ -94,7 +94,7 @@ class GLMesh{
 	void get_texture(std::string file) const{
 		auto it = texture_map.find(file);
 		if(it != texture_map.end())
-			glBindTexture(GL_TEXTURE_2D, it->second);
+			bind_texture(GL_TEXTURE_2D, it->second);
 	}
 };
 
@@ -109,12 +109,12 @@ void init_shader(){
 		Shader{"TextureShader.vert", GL_VERTEX_SHADER},
 		Shader{"TextureShader.frag", GL_FRAGMENT_SHADER}
 	};
-	glUseProgram(shaderProgram);
+	use_program(shaderProgram);
 }
 
 void init(){
 	glewInit();
-	glEnable(GL_DEPTH_TEST);
+	enable(GL_DEPTH_TEST);
 	
 	init_shader();
 	mesh = GLMesh{"modelos/Wood Table/Old Wood Table.obj", loadIdentity()};
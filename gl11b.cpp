@@ -25,7 +25,7 @@ void init_surface(){
 	auto mesh_triangles = mesh.getTriangles();
 	
 	vao = VAO{true};
-	glBindVertexArray(vao);
+	bind_vertex_array(vao);
 
 	vbo = GLBuffer{GL_ARRAY_BUFFER};
 	vbo.data(mesh_triangles, GL_STATIC_DRAW);
@@ -45,7 +45,7 @@ void init_surface(){
 
 void init(){
 	glewInit();
-	glEnable(GL_DEPTH_TEST);
+	enable(GL_DEPTH_TEST);
 	
 	init_shader();
 	init_surface();
@@ -62,7 +62,7 @@ void desenha(){
 	float a = w/(float)h;
 	mat4 Projection = scale(1,1,-1)*perspective(45, a, 0.1, 50);
 
-	glUseProgram(shaderProgram);
+	use_program(shaderProgram);
 	Uniform{"Projection"} = Projection;
 	Uniform{"View"} = View;
 	Uniform{"Model"} = Model;
@@ -77,7 +77,7 @@ void desenha(){
 	Uniform{"Ks"} = vec3{0.5, 0.5, 0.5};
 	Uniform{"shininess"} = 128.0f;
 
-	glBindVertexArray(vao);
+	bind_vertex_array(vao);
 	glDrawArrays(GL_TRIANGLES, 0, n_verts);
 
 	glutSwapBuffers();
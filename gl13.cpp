@@ -24,7 +24,7 @@ vec3 normal_treco(float x, float y, float z){
 
 void init_buffers(const std::vector<vec3>& V, const std::vector<vec3>& Normal){
 	vao = VAO{true};
-	glBindVertexArray(vao);
+	bind_vertex_array(vao);
 
 	vbo_position = GLBuffer{GL_ARRAY_BUFFER};
 	vbo_position.data(V, GL_STATIC_DRAW);
@@ -59,7 +59,7 @@ void init_shader(){
 		Shader{"PhongShader.vert", GL_VERTEX_SHADER},
 		Shader{"PhongShader.frag", GL_FRAGMENT_SHADER}
 	};
-	glUseProgram(shaderProgram);
+	use_program(shaderProgram);
 
 	Uniform{"Ka"} = vec3{0.7, 0.7, 1.0};
 	Uniform{"Kd"} = vec3{0.7, 0.7, 1.0};
@@ -74,7 +74,7 @@ void init_shader(){
 
 void init(){
 	glewInit();
-	glEnable(GL_DEPTH_TEST);
+	enable(GL_DEPTH_TEST);
 	
 	init_shader();
 	init_surface(150, 150, 150);
@@ -95,7 +95,7 @@ void desenha(){
 
 	setup_matrices();
 
-	glBindVertexArray(vao);
+	bind_vertex_array(vao);
 	glDrawArrays(GL_TRIANGLES, 0, n_verts);
 
 	glutSwapBuffers();
@@ -62,7 +62,7 @@ MetaballFigure figure;
 
 void init_buffers(){
 	vao = VAO{true};
-	glBindVertexArray(vao);
+	bind_vertex_array(vao);
 
 	vbo_position = GLBuffer{GL_ARRAY_BUFFER};
 	vbo_normal = GLBuffer{GL_ARRAY_BUFFER};
@@ -116,7 +116,7 @@ void init_shader(){
 		Shader{"PhongShader.vert", GL_VERTEX_SHADER},
 		Shader{"PhongShader.frag", GL_FRAGMENT_SHADER}
 	};
-	glUseProgram(shaderProgram);
+	use_program(shaderProgram);
 
 	Uniform{"Ka"} = vec3{2.7, 0.7, 1.5};
 	Uniform{"Kd"} = vec3{0.7, 0.7, 1.0};
@@ -131,7 +131,7 @@ void init_shader(){
 
 void init(){
 	glewInit();
-	glEnable(GL_DEPTH_TEST);
+	enable(GL_DEPTH_TEST);
 
 	init_shader();
 	init_buffers();
@@ -154,7 +154,7 @@ void desenha(){
 	setup_matrices();
 	//glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
-	glBindVertexArray(vao);
+	bind_vertex_array(vao);
 	glDrawArrays(GL_TRIANGLES, 0, n_verts);
 
 	glutSwapBuffers();
@@ -1,165 +1,9 @@
 #include <GL/glew.h>
 #include <GL/freeglut.h>
 #include "GLutils.h"
-#include "ObjMesh.h"
-
-using Vertex = ObjMesh::Vertex;
-
-GLTexture init_texture(std::string image){
-	GLTexture texture{GL_TEXTURE_2D};
-	texture.load(image);
-
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	if(GLEW_EXT_texture_filter_anisotropic){
-		GLfloat fLargest;
-		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &fLargest);
-		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, fLargest);
-	}
-	return texture;
-}
-
-MaterialInfo standard_material(std::string mat_Kd){
-	MaterialInfo mat;
-
-	mat.name = "standard";
-
-	mat.Ka = {1, 1, 1};
-	mat.Kd = {1, 1, 1};
-	mat.Ks = {0, 0, 0};
-	mat.Ns = 1;
-
-	mat.map_Kd = mat_Kd;
-
-	return mat;
-}
-
-struct SurfaceMesh{
-	std::vector<Vertex> vertices;
-	std::vector<unsigned int> indices;
-};
-
-class GLMesh{
-	VAO vao;
-	GLBuffer vbo;
-	GLBuffer ebo;
-	std::vector<MaterialRange> materials;
-	std::map<std::string, GLTexture> texture_map;
-	public:
-	mat4 Model;
-
-	GLMesh() = default;
-
-	GLMesh(std::string obj_file, mat4 _Model, MaterialInfo std_mat=standard_material("")){
-		ObjMesh mesh{obj_file};
-		std::vector<Vertex> tris = mesh.getTriangles();
-		init_buffers(tris);
-
-		materials = mesh.getMaterials(std_mat);
-
-		for(MaterialRange range: materials){
-			load_texture(mesh.path, range.mat.map_Ka);
-			load_texture(mesh.path, range.mat.map_Kd);
-			load_texture(mesh.path, range.mat.map_Ks);
-			load_texture(mesh.path, range.mat.map_Bump);
-		}
-
-		Model = _Model;
-	}
-
-	GLMesh(const SurfaceMesh& surface, mat4 _Model, MaterialInfo std_mat = standard_material("")){
-		Model = _Model;
-		init_buffers(surface.vertices);
-
-		ebo = GLBuffer{GL_ELEMENT_ARRAY_BUFFER};
-		ebo.data(surface.indices, GL_STATIC_DRAW);
-
-		unsigned int size = surface.indices.size();
-
-		materials = {
-			{std_mat, 0, size}
-		};
-		load_texture("", std_mat.map_Kd);
-	}
-
-	void init_buffers(const std::vector<Vertex>& vertices){
-		vao = VAO{true};
-		glBindVertexArray(vao);
-
-		vbo = GLBuffer{GL_ARRAY_BUFFER};
-		vbo.data(vertices, GL_STATIC_DRAW);
-
-		size_t stride = sizeof(Vertex);
-		size_t offset_position = offsetof(Vertex, position);
-		size_t offset_texCoords = offsetof(Vertex, texCoords);
-		size_t offset_normal = offsetof(Vertex, normal);
-
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offset_position);
-
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride,(void*)offset_texCoords);
-
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride,(void*)offset_normal);
-	}
-
-	void load_texture(std::string path, std::string file){
-		if(file != "" && texture_map.find(file) == texture_map.end()){
-			std::string img = path + file;
-			std::cout << "read image " << img << '\n';
-			texture_map[file] = init_texture(img);
-		}
-	}
-
-	void draw(MaterialRange range) const{
-		Uniform{"Ka"} = range.mat.Ka;
-		Uniform{"Kd"} = range.mat.Kd;
-		Uniform{"Ks"} = range.mat.Ks;
-		Uniform{"shininess"} = range.mat.Ns;
-
-		bool has_map_Ka = texture_map.find(range.mat.map_Ka) != texture_map.end();
-		Uniform{"has_map_Ka"} = has_map_Ka;
-		if(has_map_Ka){
-			Uniform{"map_Ka"} = 0;
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, texture_map.at(range.mat.map_Ka));
-		}
-
-		bool has_map_Kd = texture_map.find(range.mat.map_Kd) != texture_map.end();
-		Uniform{"has_map_Kd"} = has_map_Kd;
-		if(has_map_Kd){
-			Uniform{"map_Kd"} = 1;
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, texture_map.at(range.mat.map_Kd));
-		}
-
-		bool has_map_Ks = texture_map.find(range.mat.map_Ks) != texture_map.end();
-		Uniform{"has_map_Ks"} = has_map_Ks;
-		if(has_map_Ks){
-			Uniform{"map_Ks"} = 2;
-			glActiveTexture(GL_TEXTURE2);
-			glBindTexture(GL_TEXTURE_2D, texture_map.at(range.mat.map_Ks));
-		}
-
-		glBindVertexArray(vao);
-		if(ebo == 0)
-			glDrawArrays(GL_TRIANGLES, range.first, range.count);
-		else
-			glDrawElements(GL_TRIANGLES, range.count, GL_UNSIGNED_INT, (void*)(range.first*sizeof(int)));
-	}
-
-	void draw() const{
-		Uniform{"Model"} = Model;
-		for(MaterialRange range: materials)
-			draw(range);
-	}
-};
+#include "GLMesh.h"
+#include "Skybox.h"
+#include <random>
 
 SurfaceMesh flag_mesh(int m, int n){
 	int N = m*n;
@@ -202,122 +46,311 @@ SurfaceMesh flag_mesh(int m, int n){
 }
 
 ShaderProgram shaderProgram;
+ShaderProgram instancedProgram;
+// declared before meshes, which give their geometry back to it
+GeometryHeap geometry_heap;
+GLMesh moco, tree;
+InstanceList moco_copies, forest;
+int forest_size = 20000; // gl14 -n
+double instances_ms = 0; // culling and upload of the instance lists
+GLuint forest_query = 0;  // GPU time of the instanced draw of the forest
+TransformStage transforms;
+SceneBVH bvh;
+OcclusionCuller occlusion;
+std::vector<unsigned int> visible;
 std::vector<GLMesh> meshes;
+Skybox skybox;
+std::vector<std::string> skybox_faces;
 
 mat4 BaseView = lookAt({0, 7, 20}, {0, 7, 0}, {0, 1, 0});
 float vangle = 0;
 
 void init_scene(){
+	GLMeshOptions options;
+	options.heap = &geometry_heap;
+
+	GLMeshOptions occluder = options;
+	occluder.occluder = true;
+
 	meshes.emplace_back(
 		flag_mesh(80, 80),
 		translate(0, 20, -22)*scale(3*1.4282, 3, 3),
-		standard_material("comum.png")
+		standard_material("comum.png"),
+		options
 	);
 
 	meshes.emplace_back(
 		"modelos/bunny.obj",
 		translate(14, 8, -10),
-		standard_material("../blue.png")
+		standard_material("../blue.png"),
+		options
 	);
 
 	meshes.emplace_back(
 		"modelos/teapot.obj",
 		translate(0,5.0,-2)*scale(.14,.14,.14)*rotate_x(-M_PI/2),
-		standard_material("../cafe.jpg")
+		standard_material("../cafe.jpg"),
+		options
 	);
 
 	meshes.emplace_back(
 		"modelos/wall.obj",
 		scale(100, 100, 100),
-		standard_material("../piso_geo.jpg")
+		standard_material("../piso_geo.jpg"),
+		occluder
 	);
 
 	meshes.emplace_back(
 		"modelos/other table/Wood_Table.obj",
-		translate(0,1.08,-2)*rotate_y(-M_PI/2)*scale(8,8,8)
-	);
-
-	meshes.emplace_back(
-		"modelos/moco.obj",
-		translate(-250, -50, 0)*rotate_y(1.5)*scale(5, 5, 5)
-
-	);
-
-		meshes.emplace_back(
-		"modelos/moco.obj",
-		translate(-250, -50, 25)*rotate_y(1.5)*scale(5, 5, 5)
-
-	);
-
-		meshes.emplace_back(
-		"modelos/moco.obj",
-		translate(-250, -50, 50)*rotate_y(1.5)*scale(5, 5, 5)
-
-	);
-
-		meshes.emplace_back(
-		"modelos/moco.obj",
-		translate(-250, -50, 75)*rotate_y(1.5)*scale(5, 5, 5)
-
+		translate(0,1.08,-2)*rotate_y(-M_PI/2)*scale(8,8,8),
+		standard_material(""),
+		options
 	);
 
-		meshes.emplace_back(
-		"modelos/moco.obj",
-		translate(-250, -50, 100)*rotate_y(1.5)*scale(5, 5, 5)
-
-	);
+	// copies drawn with instancing
+	moco = GLMesh{"modelos/moco.obj", loadIdentity(), standard_material(""), options};
+	moco_copies = InstanceList{moco.bbox_min, moco.bbox_max};
+	for(int i = 0; i < 5; i++)
+		moco_copies.add(translate(-250, -50, 25*i)*rotate_y(1.5)*scale(5, 5, 5));
+
+	tree = GLMesh{"modelos/low_poly_tree/lowpoly_tree_sample.obj", loadIdentity(), standard_material(""), options};
+	forest = InstanceList{tree.bbox_min, tree.bbox_max};
+	forest.add(translate(15,0,-10)*scale(0.5,0.5,0.5));
+
+	std::mt19937 rng{1};
+	std::uniform_real_distribution<float> u{0, 1};
+	for(int i = 0; i < forest_size; i++){
+		float x = -95 + 190*u(rng);
+		float z = -95 + 190*u(rng);
+		float s = 0.3 + 0.4*u(rng);
+		float g = 0.7 + 0.3*u(rng);
+		forest.add(translate(x, 0, z)*rotate_y(2*M_PI*u(rng))*scale(s, s, s), {g*(0.8f + 0.2f*u(rng)), g, g*0.8f, 1});
+	}
+}
 
-	meshes.emplace_back(
-        "modelos/low_poly_tree/lowpoly_tree_sample.obj",
-        translate(15,0,-10)*scale(0.5,0.5,0.5)
-    );
+void build_bvh(){
+	std::vector<AABB> bounds;
+	for(const GLMesh& mesh: meshes)
+		bounds.push_back(mesh.world_bounds());
+	bvh.build(bounds);
 }
 
 void init(){
 	glewInit();
-	glEnable(GL_DEPTH_TEST);
+	enable(GL_DEPTH_TEST);
 
 	shaderProgram = ShaderProgram{
 		Shader{"PhongShaderTex.vert", GL_VERTEX_SHADER},
 		Shader{"PhongShaderTex.frag", GL_FRAGMENT_SHADER}
 	};
 
+	instancedProgram = ShaderProgram{
+		Shader{"PhongInstanced.vert", GL_VERTEX_SHADER},
+		Shader{"PhongShaderTex.frag", GL_FRAGMENT_SHADER}.with_defines({"INSTANCED"})
+	};
+
 	init_scene();
+	build_bvh();
+
+	if(skybox_faces.size() == 6)
+		skybox = Skybox{{
+			skybox_faces[0], skybox_faces[1], skybox_faces[2], 
+			skybox_faces[3], skybox_faces[4], skybox_faces[5]
+		}};
+	else
+		skybox = Skybox{procedural_sky(256, {0.1, 0.35, 0.8}, {0.27, 0.67, .93}, {0.3, 0.3, 0.3})};
 }
 
-void desenha(){
+void set_uniforms(mat4 View, mat4 Projection){
+	Uniform{"View"} = View;
+	Uniform{"Projection"} = Projection;
+
+	Uniform{"light_position"} = vec4{0, 5, 10, 1};
+	Uniform{"Ia"} = vec3{ 0.2, 0.2, 0.2};
+	Uniform{"Id"} = vec3{ 0.8, 0.8, 0.8};
+	Uniform{"Is"} = vec3{ 0.8, 0.8, 0.8};
+}
+
+void draw_frame(bool skybox_first){
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	int w = glutGet(GLUT_WINDOW_WIDTH);
 	int h = glutGet(GLUT_WINDOW_HEIGHT);
 	glViewport(0, 0, w, h);
 
-	glClearColor(0.27, 0.67, .93, 1);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	glUseProgram(shaderProgram);
+	// the skybox covers every pixel, only depth needs to be cleared
+	glClear(GL_DEPTH_BUFFER_BIT);
 
 	float a = w/(float)h;
 
 	mat4 Projection = scale(1,1,-1)*perspective(45, a, 0.1, 500);
 	mat4 View = rotate_x(vangle)*BaseView;
-	Uniform{"Projection"} = Projection;
-	Uniform{"View"} = View;
-
-	Uniform{"light_position"} = vec4{0, 5, 10, 1};
-	Uniform{"Ia"} = vec3{ 0.2, 0.2, 0.2};
-	Uniform{"Id"} = vec3{ 0.8, 0.8, 0.8};
-	Uniform{"Is"} = vec3{ 0.8, 0.8, 0.8};
 
 	for(const GLMesh& mesh: meshes)
-		mesh.draw();
+		if(mesh.is_occluder())
+			occlusion.add_occluder(mesh.occluder_triangles(), mesh.Model);
+	occlusion.begin(View, Projection);
+
+	if(skybox_first)
+		skybox.draw(View, Projection);
+
+	use_program(shaderProgram);
+	set_uniforms(View, Projection);
+
+	Frustum frustum{Projection*View};
+	visible.clear();
+	bvh.query(frustum, [](unsigned int i){
+		visible.push_back(i);
+	});
+
+	// the occluders are rasterized while the frustum is tested
+	occlusion.finish();
+	visible.erase(std::remove_if(visible.begin(), visible.end(), [](unsigned int i){
+		const GLMesh& m = meshes[i];
+		return !m.is_occluder() && !occlusion.visible(m.Model, m.bbox_min, m.bbox_max);
+	}), visible.end());
+
+	transforms.clear();
+	for(unsigned int i: visible)
+		meshes[i].transform = transforms.add(meshes[i].Model);
+	transforms.update(View, Projection);
+
+	for(unsigned int i: visible)
+		meshes[i].draw();
+
+	auto t0 = std::chrono::steady_clock::now();
+	moco_copies.cull(frustum);
+	forest.cull(frustum);
+	auto t1 = std::chrono::steady_clock::now();
+	instances_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+
+	use_program(instancedProgram);
+	set_uniforms(View, Projection);
+	moco.draw(moco_copies);
+	if(forest_query)
+		glBeginQuery(GL_TIME_ELAPSED, forest_query);
+	tree.draw(forest);
+	if(forest_query)
+		glEndQuery(GL_TIME_ELAPSED);
+
+	if(!skybox_first)
+		skybox.draw(View, Projection);
+}
 
+void desenha(){
+	draw_frame(false);
 	glutSwapBuffers();
 }
 
+// GPU time (ms) per frame, with the skybox drawn before or after the scene.
+double frame_time(bool skybox_first, int n_frames){
+	GLuint query;
+	glGenQueries(1, &query);
+
+	double total = 0;
+	for(int i = 0; i < n_frames; i++){
+		glBeginQuery(GL_TIME_ELAPSED, query);
+		draw_frame(skybox_first);
+		glEndQuery(GL_TIME_ELAPSED);
+
+		GLuint64 ns;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+		total += ns;
+	}
+
+	glDeleteQueries(1, &query);
+	return total/n_frames*1e-6;
+}
+
+// Cull and upload (CPU) and instanced draw (GPU) of the forest, in ms
+// per frame.
+void forest_time(int n_frames){
+	glGenQueries(1, &forest_query);
+
+	double cull = 0, upload = 0, draw = 0;
+	for(int i = 0; i < n_frames; i++){
+		draw_frame(false);
+		GLuint64 ns;
+		glGetQueryObjectui64v(forest_query, GL_QUERY_RESULT, &ns);
+		draw += ns*1e-6;
+		cull += forest.stats.cull_ms;
+		upload += forest.stats.upload_ms;
+	}
+
+	glDeleteQueries(1, &forest_query);
+	forest_query = 0;
+	printf("%u of %u trees: cull %.3f ms, upload %.3f ms, draw %.3f ms (GPU) per frame\n",
+		forest.count(), forest.size(), cull/n_frames, upload/n_frames, draw/n_frames);
+}
+
+void keyboard(unsigned char key, int x, int y){
+	if(key == 'b'){
+		int n = 100;
+		frame_time(false, 10); // warm up
+		double first = frame_time(true, n);
+		double last = frame_time(false, n);
+		printf("skybox first: %.3f ms/frame\n", first);
+		printf("skybox last:  %.3f ms/frame\n", last);
+		glutPostRedisplay();
+	}
+	if(key == 'i'){
+		forest_time(10); // warm up
+		forest_time(100);
+		glutPostRedisplay();
+	}
+	if(key == 't')
+		texture_cache.report();
+	if(key == 'g')
+		geometry_heap.report();
+	if(key == 'd'){
+		geometry_heap.defragment();
+		geometry_heap.report();
+	}
+	if(key == 'x' && !meshes.empty()){
+		// the range of the mesh goes back to the heap, no GL object is deleted
+		meshes.pop_back();
+		build_bvh();
+		geometry_heap.report();
+		glutPostRedisplay();
+	}
+	if(key == 'c')
+		printf("Meshes: %u drawn, %u outside the frustum, %u occluded\n", 
+			(unsigned int)visible.size(), (unsigned int)(meshes.size() - visible.size()) - occlusion.stats.occluded, 
+			occlusion.stats.occluded);
+	if(key == 'c')
+		printf("Instances: %u of %u mocos, %u of %u trees (cull and upload %.2f ms)\n",
+			moco_copies.count(), moco_copies.size(), forest.count(), forest.size(), instances_ms);
+}
+
+// Mesh under the pixel (x, y), or -1.
+int pick(int x, int y){
+	int w = glutGet(GLUT_WINDOW_WIDTH);
+	int h = glutGet(GLUT_WINDOW_HEIGHT);
+	float t = tan(45*M_PI/360);
+	vec3 d = {(2*(x + 0.5f)/w - 1)*t*w/h, (1 - 2*(y + 0.5f)/h)*t, -1};
+
+	// View is rigid: its inverse is the transpose of the rotation
+	mat4 View = rotate_x(vangle)*BaseView;
+	vec3 eye = {0, 0, 0}, dir = {0, 0, 0};
+	for(int i = 0; i < 3; i++){
+		vec3 row = toVec3(View[i]);
+		eye = eye - View[i][3]*row;
+		dir = dir + (i == 0? d.x: i == 1? d.y: d.z)*row;
+	}
+
+	float hit;
+	return bvh.raycast(eye, dir, hit);
+}
+
 int last_x, last_y;
 void mouse(int button, int state, int x, int y){
 	last_x = x;
 	last_y = y;
+
+	if(button == GLUT_RIGHT_BUTTON && state == GLUT_DOWN){
+		int i = pick(x, y);
+		if(i >= 0)
+			printf("Mesh %d\n", i);
+	}
 }
 
 void mouseMotion(int x, int y){
@@ -354,8 +387,25 @@ void special(int key, int x, int y){
 	glutPostRedisplay();
 }
 
+// gl14 [-n arvores] [+X -X +Y -Y +Z -Z]: número de árvores da floresta
+// instanciada (padrão 20000) e imagens das faces do skybox (opcionais)
+// Tecla 'b': compara o tempo do quadro com o skybox antes e depois da cena.
+// Tecla 'i': tempo do culling, envio e desenho das árvores instanciadas.
+// Tecla 't': lista as texturas repetidas e a memória economizada.
+// Tecla 'g': ocupação e fragmentação dos buffers de geometria compartilhados.
+// Tecla 'd': desfragmenta esses buffers.
+// Tecla 'x': remove a última malha, devolvendo sua geometria.
+// Tecla 'c': objetos e cópias instanciadas desenhados.
+// Botão direito: mostra o índice do objeto sob o cursor.
 int main(int argc, char* argv[]){
 	glutInit(&argc, argv);
+	int first = 1;
+	if(argc > 2 && std::string(argv[1]) == "-n"){
+		forest_size = atoi(argv[2]);
+		first = 3;
+	}
+	for(int i = first; i < argc; i++)
+		skybox_faces.push_back(argv[i]);
 	glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_MULTISAMPLE | GLUT_DEPTH);
 	glutInitWindowSize(800, 600);
 	glutInitContextVersion(3, 3);
@@ -366,6 +416,7 @@ int main(int argc, char* argv[]){
 	glutMouseFunc(mouse);
 	glutMotionFunc(mouseMotion);
 	glutSpecialFunc(special);
+	glutKeyboardFunc(keyboard);
 
 	printf("GL Version: %s\n", glGetString(GL_VERSION));
 	printf("GLSL Version: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
@@ -0,0 +1,117 @@
+// Converte imagens (PNG, JPG, ...) para o formato QOI.
+//
+//   img2qoi imagem.png [imagem.qoi]
+//   img2qoi a.png b.png c.png ...     (gera a.qoi, b.qoi, c.qoi)
+//
+// Opções (antes das imagens):
+//   -r razao   só grava o QOI se ele tiver até razao vezes o tamanho do
+//              arquivo original (padrão 1.25); as demais ficam em PNG
+//   -f         grava o QOI sempre
+//
+// O QOI decodifica bem mais rápido que o PNG, mas não tem compressão
+// por entropia: mapas grandes e suaves (normais, sombras) chegam a ter
+// 1.5x a 4x o tamanho do PNG, e para esses o PNG continua melhor.
+//
+// Imagens em tons de cinza são expandidas para RGB (ou RGBA),
+// pois o QOI armazena apenas 3 ou 4 canais.
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fstream>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "QOI.h"
+
+double max_ratio = 1.25;
+
+size_t total_in = 0;  // bytes das imagens de entrada
+size_t total_out = 0; // bytes do que fica em disco (QOI ou o original)
+
+std::string qoi_name(std::string filename){
+	auto pos = filename.find_last_of('.');
+	return filename.substr(0, pos) + ".qoi";
+}
+
+size_t file_size(std::string filename){
+	std::ifstream in(filename, std::ios::binary | std::ios::ate);
+	return in? (size_t)in.tellg(): 0;
+}
+
+bool convert(std::string in, std::string out){
+	int width, height, nrChannels;
+	if(!stbi_info(in.c_str(), &width, &height, &nrChannels)){
+		printf("ERROR: could not read %s\n", in.c_str());
+		return false;
+	}
+
+	int channels = (nrChannels == 2 || nrChannels == 4)? 4: 3;
+	unsigned char* data = stbi_load(in.c_str(), &width, &height, &nrChannels, channels);
+	if(data == NULL){
+		printf("ERROR: could not read %s\n", in.c_str());
+		return false;
+	}
+
+	QOIDesc desc;
+	desc.width = width;
+	desc.height = height;
+	desc.channels = channels;
+	std::vector<unsigned char> qoi = qoi_encode(data, desc);
+	stbi_image_free(data);
+	if(qoi.empty()){
+		printf("ERROR: could not encode %s\n", in.c_str());
+		return false;
+	}
+
+	size_t in_size = file_size(in);
+	total_in += in_size;
+
+	if(max_ratio > 0 && qoi.size() > max_ratio*in_size){
+		printf("%s: kept, QOI would be %.2f MB against %.2f MB (%.1fx)\n", in.c_str(),
+			qoi.size()/1048576.0, in_size/1048576.0, (double)qoi.size()/in_size);
+		total_out += in_size;
+		return true;
+	}
+
+	std::ofstream file(out, std::ios::binary);
+	file.write((const char*)qoi.data(), qoi.size());
+	if(!file.good()){
+		printf("ERROR: could not write %s\n", out.c_str());
+		return false;
+	}
+	printf("%s -> %s (%.2f MB -> %.2f MB)\n", in.c_str(), out.c_str(),
+		in_size/1048576.0, qoi.size()/1048576.0);
+	total_out += qoi.size();
+	return true;
+}
+
+int main(int argc, char* argv[]){
+	int first = 1;
+	while(first < argc && argv[first][0] == '-'){
+		std::string opt = argv[first];
+		if(opt == "-f"){
+			max_ratio = 0;
+			first++;
+		}else if(opt == "-r" && first+1 < argc){
+			max_ratio = atof(argv[first+1]);
+			first += 2;
+		}else{
+			first = argc;
+		}
+	}
+
+	if(first >= argc){
+		printf("usage: %s [-r ratio | -f] image [image.qoi]\n"
+		       "       %s [-r ratio | -f] image1 image2 ...\n", argv[0], argv[0]);
+		return 1;
+	}
+
+	if(argc - first == 2 && is_qoi_file(argv[first+1]))
+		return convert(argv[first], argv[first+1])? 0: 1;
+
+	int errors = 0;
+	for(int i = first; i < argc; i++)
+		errors += !convert(argv[i], qoi_name(argv[i]));
+
+	printf("%.1f MB of images, %.1f MB on disk after conversion\n", total_in/1048576.0, total_out/1048576.0);
+	return errors? 1: 0;
+}